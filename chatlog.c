@@ -0,0 +1,225 @@
+/*
+ * chatlog: append-only file of everything received, reloaded at startup
+ */
+#include "chatlog.h"
+#include "metrics.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+static void addMark(struct chatlog *log, uint64_t line, uint64_t off)
+{
+  if (log->marks_buffered == CHATLOG_MARKS_MAX)
+    chatlogFlush(log);
+  log->marks[log->marks_buffered].line = line;
+  log->marks[log->marks_buffered].off = off;
+  log->marks_buffered++;
+}
+
+/*
+  Drop index marks past the end of a log of size bytes (written before
+  a crash lost the lines they point at) and any half-written one.
+  *from is where to start reading the log: the second last mark, so
+  there are at least CHATLOG_INDEX_EVERY lines after it, or the start.
+  Returns the line number of the last mark.
+*/
+static uint64_t lastMarks(struct chatlog *log, uint64_t size, struct chatlog_mark *from)
+{
+  struct chatlog_mark mark = {0, 0};
+  struct stat st;
+  off_t n;
+
+  memset(from, 0, sizeof(*from));
+  if (fstat(log->index_fd, &st) != 0)
+    return 0;
+  n = st.st_size / sizeof(mark);
+  if (st.st_size % sizeof(mark) != 0)
+    ftruncate(log->index_fd, n * sizeof(mark));
+  while (n > 0)
+  {
+    if (pread(log->index_fd, &mark, sizeof(mark), (n - 1) * sizeof(mark)) == sizeof(mark) &&
+        mark.off <= size)
+      break;
+    ftruncate(log->index_fd, --n * sizeof(mark));
+  }
+  if (n == 0)
+    return 0;
+  if (n >= 2 && pread(log->index_fd, from, sizeof(*from), (n - 2) * sizeof(*from)) != sizeof(*from))
+    memset(from, 0, sizeof(*from));
+  return mark.line;
+}
+
+/*
+  Read the log from the mark on through a read-only mapping: count its
+  lines, mark any the index is missing, and hand the last tail_lines to
+  replay.  Returns -1 if it couldn't be mapped.
+*/
+static int scanTail(struct chatlog *log, const struct chatlog_mark *from, uint64_t marked,
+                    unsigned tail_lines, void (*replay)(const char *line, size_t len))
+{
+  long page = sysconf(_SC_PAGESIZE);
+  uint64_t base = from->off / page * page, line = from->line;
+  const char *map, *start, *end, *p, *q, *nl;
+  unsigned back = 0;
+
+  log->lines = line;
+  if (log->size == from->off)
+    return 0;
+  map = mmap(NULL, log->size - base, PROT_READ, MAP_PRIVATE, log->fd, base);
+  if (map == MAP_FAILED)
+    return -1;
+  start = map + (from->off - base);
+  end = map + (log->size - base);
+  for (p = start; p < end; p = nl + 1, line++)
+  {
+    if (line > marked && line % CHATLOG_INDEX_EVERY == 0)
+      addMark(log, line, base + (p - map));
+    if ((nl = memchr(p, '\n', end - p)) == NULL)
+      nl = end; /* Cut off by a crash mid-write */
+  }
+  log->lines = line;
+
+  /* Back from the end to the start of the last tail_lines lines.  q is
+     just past the line before it, so an empty line is one too */
+  p = end;
+  for (q = end; q > start && back < tail_lines; back++)
+  {
+    for (nl = q - 1; nl > start && nl[-1] != '\n'; nl--)
+      ;
+    p = q = nl;
+  }
+  for (; p < end; p = nl + 1)
+  {
+    if ((nl = memchr(p, '\n', end - p)) == NULL)
+      nl = end;
+    replay(p, nl - p);
+  }
+  if (end[-1] != '\n' && write(log->fd, "\n", 1) == 1)
+    log->size++;
+  munmap((void *)map, end - map);
+  return 0;
+}
+
+/*
+ * Open the log at path (created if missing) and its index, and give
+ * its last tail_lines lines to replay, oldest first.  How long that
+ * takes depends on the index spacing, not on the size of the log.  A
+ * NULL path means no log.  Returns 0 on success, -1 if either file
+ * couldn't be opened or read.
+ */
+int chatlogOpen(struct chatlog *log, const char *path, unsigned tail_lines,
+                void (*replay)(const char *line, size_t len))
+{
+  char index_path[PATH_MAX];
+  struct chatlog_mark from;
+  uint64_t marked, start = monotonicNs();
+  struct stat st;
+
+  memset(log, 0, sizeof(*log));
+  log->fd = log->index_fd = -1;
+  if (path == NULL)
+    return 0;
+  if (snprintf(index_path, sizeof(index_path), "%s.idx", path) >= (int)sizeof(index_path) ||
+      (log->fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) < 0 ||
+      (log->index_fd = open(index_path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) < 0 ||
+      fstat(log->fd, &st) != 0)
+  {
+    chatlogClose(log);
+    return -1;
+  }
+  log->size = st.st_size;
+  marked = lastMarks(log, log->size, &from);
+  if (scanTail(log, &from, marked, tail_lines, replay) != 0)
+  {
+    chatlogClose(log);
+    return -1;
+  }
+  chatlogFlush(log); /* Marks it had to add */
+  chatlog_reload_ns = monotonicNs() - start;
+  return 0;
+}
+
+/*
+ * Add a received line.  It goes out with the next chatlogFlush().
+ */
+void chatlogAppend(struct chatlog *log, const char *line, size_t len)
+{
+  struct iovec iov[2] = {{(void *)line, len}, {"\n", 1}};
+
+  if (log->fd < 0)
+    return;
+  if (log->lines > 0 && log->lines % CHATLOG_INDEX_EVERY == 0)
+    addMark(log, log->lines, log->size);
+  if (len + 1 > sizeof(log->buf) - log->buffered)
+    chatlogFlush(log);
+  if (len + 1 > sizeof(log->buf))
+  {
+    /* Too long to gather: straight out behind what was */
+    if (writev(log->fd, iov, 2) > 0)
+      chatlog_writes++;
+    log->unsynced = true;
+  }
+  else
+  {
+    memcpy(log->buf + log->buffered, line, len);
+    log->buf[log->buffered + len] = '\n';
+    log->buffered += len + 1;
+  }
+  log->size += len + 1;
+  log->lines++;
+  chatlog_bytes += len + 1;
+}
+
+/*
+ * Write out the lines gathered so far with one write, then the index
+ * marks that point into them.  A write that fails loses those lines
+ * from the log only; the screen still has them.
+ */
+void chatlogFlush(struct chatlog *log)
+{
+  if (log->fd < 0)
+    return;
+  if (log->buffered > 0)
+  {
+    if (write(log->fd, log->buf, log->buffered) > 0)
+      chatlog_writes++;
+    log->buffered = 0;
+    log->unsynced = true;
+  }
+  if (log->marks_buffered > 0)
+  {
+    write(log->index_fd, log->marks, log->marks_buffered * sizeof(log->marks[0]));
+    log->marks_buffered = 0;
+    log->unsynced = true;
+  }
+}
+
+/*
+ * Get what has been written onto the disk.
+ */
+void chatlogSync(struct chatlog *log)
+{
+  chatlogFlush(log);
+  if (log->fd < 0 || !log->unsynced)
+    return;
+  fdatasync(log->fd);
+  fdatasync(log->index_fd);
+  log->unsynced = false;
+  chatlog_syncs++;
+}
+
+void chatlogClose(struct chatlog *log)
+{
+  chatlogSync(log);
+  if (log->fd >= 0)
+    close(log->fd);
+  if (log->index_fd >= 0)
+    close(log->index_fd);
+  log->fd = log->index_fd = -1;
+}
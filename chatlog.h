@@ -0,0 +1,50 @@
+#ifndef _CHATLOG_H
+#define _CHATLOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define CHATLOG_BUF_SIZE (64 * 1024) /* Lines gathered for one write */
+#define CHATLOG_INDEX_EVERY 1024     /* Lines between index marks */
+#define CHATLOG_MARKS_MAX 16         /* Marks gathered for one write */
+#define CHATLOG_SYNC_MS 1000         /* Longest written data waits for fdatasync() */
+
+/* Line number line of the log starts at byte off */
+struct chatlog_mark
+{
+  uint64_t line;
+  uint64_t off;
+};
+
+/*
+ * Everything received, kept in a file so it survives a restart.  The
+ * log is only ever appended to, one line per message; lines are
+ * gathered in buf and written together (once per main loop pass, or
+ * when it fills), and fdatasync()ed no more than CHATLOG_SYNC_MS later.
+ *
+ * A sparse index goes alongside it in path.idx: a chatlog_mark for
+ * every CHATLOG_INDEX_EVERY lines.  Reopening maps only the log from
+ * the second last mark on, whatever the log's size, which is enough to
+ * count its lines and give back the last few.
+ */
+struct chatlog
+{
+  int fd;       /* Log, or -1 if there is none */
+  int index_fd;
+  uint64_t size;  /* Bytes in the log, buffered ones included */
+  uint64_t lines; /* Lines in the log */
+  char buf[CHATLOG_BUF_SIZE];
+  size_t buffered;
+  struct chatlog_mark marks[CHATLOG_MARKS_MAX];
+  size_t marks_buffered;
+  bool unsynced; /* Written since the last fdatasync() */
+};
+
+extern int chatlogOpen(struct chatlog *log, const char *path, unsigned tail_lines,
+                       void (*replay)(const char *line, size_t len));
+extern void chatlogAppend(struct chatlog *log, const char *line, size_t len);
+extern void chatlogFlush(struct chatlog *log);
+extern void chatlogSync(struct chatlog *log);
+extern void chatlogClose(struct chatlog *log);
+#endif
@@ -0,0 +1,332 @@
+/*
+ * chatserver: local stand-in for the lab chat server
+ *
+ * Accepts any number of clients and sends every line one of them sends
+ * to all of them, sender included.  Lines are newline terminated; a
+ * client whose output backs up past CLIENT_OUT_SIZE is disconnected
+ * rather than let it stall everybody else.
+ *
+ * Usage: chatserver [-a address] [-p port] [-g greeting]
+ *
+ * Ctrl-C prints how many lines and bytes went through.
+ *
+ * References:
+ *
+ * man 7 epoll
+ */
+#define _GNU_SOURCE /* accept4 */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define DEFAULT_PORT 42000
+#define MAX_CLIENTS 4096
+#define MAX_FDS 65536
+#define MAX_EVENTS 64
+#define CLIENT_LINE_SIZE 4096       /* Longer lines are split */
+#define CLIENT_OUT_SIZE (256 * 1024) /* Unsent bytes before a client is dropped */
+
+struct client
+{
+  int fd;
+  int index; /* In clients[] */
+  char line[CLIENT_LINE_SIZE]; /* Partial line received */
+  size_t line_len;
+  char *out; /* Waiting to be written to this client */
+  size_t out_head, out_len;
+  bool want_write;
+};
+
+static struct client *clients[MAX_CLIENTS]; /* Dense, for broadcast */
+static struct client *by_fd[MAX_FDS];        /* For epoll events */
+static int num_clients;
+static int epfd;
+static uint64_t lines_in, bytes_out, dropped_clients;
+
+static void dropClient(struct client *c)
+{
+  clients[c->index] = clients[--num_clients];
+  clients[c->index]->index = c->index;
+  by_fd[c->fd] = NULL;
+  epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+  close(c->fd);
+  free(c->out);
+  free(c);
+}
+
+static void setInterest(struct client *c, bool want)
+{
+  struct epoll_event ev = {.events = EPOLLIN | (want ? EPOLLOUT : 0), .data.fd = c->fd};
+
+  if (want == c->want_write)
+    return;
+  epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+  c->want_write = want;
+}
+
+/*
+  Write what the socket takes now.  Returns -1 if the client is gone.
+*/
+static int flushClient(struct client *c)
+{
+  while (c->out_len > 0)
+  {
+    ssize_t n = send(c->fd, c->out + c->out_head, c->out_len, MSG_NOSIGNAL);
+    if (n > 0)
+    {
+      bytes_out += n;
+      c->out_head += n;
+      c->out_len -= n;
+    }
+    else if (n < 0 && errno == EINTR)
+      continue;
+    else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      break;
+    else
+      return -1;
+  }
+  if (c->out_len == 0)
+    c->out_head = 0;
+  setInterest(c, c->out_len > 0);
+  return 0;
+}
+
+/*
+  Append to a client's output.  Returns -1 if it has fallen too far behind.
+*/
+static int queueClient(struct client *c, const char *data, size_t len)
+{
+  if (c->out_len + len > CLIENT_OUT_SIZE)
+    return -1;
+  if (c->out_head + c->out_len + len > CLIENT_OUT_SIZE)
+  {
+    memmove(c->out, c->out + c->out_head, c->out_len);
+    c->out_head = 0;
+  }
+  memcpy(c->out + c->out_head + c->out_len, data, len);
+  c->out_len += len;
+  return 0;
+}
+
+/*
+  Queue one line for everyone, then try to write it out.  Walks the list
+  backwards so dropping a client (which moves the last one into its
+  slot) doesn't skip anybody.
+*/
+static void broadcast(const char *line, size_t len)
+{
+  lines_in++;
+  for (int i = num_clients - 1; i >= 0; i--)
+  {
+    if (queueClient(clients[i], line, len) < 0 || flushClient(clients[i]) < 0)
+    {
+      dropped_clients++;
+      dropClient(clients[i]);
+    }
+  }
+}
+
+/*
+  Read what a client sent and broadcast each complete line.  Returns -1
+  once it has hung up, 1 if the broadcast dropped it already.
+*/
+static int readClient(struct client *c)
+{
+  char buf[16 * 1024];
+  int fd = c->fd;
+  ssize_t n;
+
+  for (;;)
+  {
+    n = read(c->fd, buf, sizeof(buf));
+    if (n == 0 || (n < 0 && errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK))
+      return -1;
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return 0;
+    for (ssize_t i = 0; i < n; i++)
+    {
+      c->line[c->line_len++] = buf[i];
+      if (buf[i] == '\n' || c->line_len == CLIENT_LINE_SIZE)
+      {
+        size_t len = c->line_len;
+        char line[CLIENT_LINE_SIZE];
+        /* broadcast() may drop c itself, so work from a copy */
+        memcpy(line, c->line, len);
+        c->line_len = 0;
+        broadcast(line, len);
+        if (by_fd[fd] != c)
+          return 1;
+      }
+    }
+    if ((size_t)n < sizeof(buf))
+      return 0;
+  }
+}
+
+static void acceptClients(int lfd, const char *greeting)
+{
+  int fd;
+
+  while ((fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+  {
+    struct client *c = NULL;
+    struct epoll_event ev = {.events = EPOLLIN, .data.fd = fd};
+
+    if (num_clients == MAX_CLIENTS || fd >= MAX_FDS ||
+        (c = calloc(1, sizeof(*c))) == NULL || (c->out = malloc(CLIENT_OUT_SIZE)) == NULL)
+    {
+      free(c);
+      close(fd);
+      continue;
+    }
+    c->fd = fd;
+    c->index = num_clients;
+    clients[num_clients++] = c;
+    by_fd[fd] = c;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+    if (greeting && (queueClient(c, greeting, strlen(greeting)) < 0 ||
+                     queueClient(c, "\n", 1) < 0 || flushClient(c) < 0))
+      dropClient(c);
+  }
+}
+
+/*
+  The port number in s, or -1 unless it is a number from 1 to 65535.
+*/
+static int parsePort(const char *s)
+{
+  char *end;
+  long port;
+
+  errno = 0;
+  port = strtol(s, &end, 10);
+  if (errno != 0 || end == s || *end != '\0' || port < 1 || port > 65535)
+    return -1;
+  return port;
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr, "Usage: %s [-a address] [-p port] [-g greeting]\n", prog);
+  fprintf(stderr, "  -a ADDR   address to listen on (default 127.0.0.1)\n");
+  fprintf(stderr, "  -p PORT   port to listen on (default %d)\n", DEFAULT_PORT);
+  fprintf(stderr, "  -g TEXT   line sent to each client when it connects\n");
+}
+
+int main(int argc, char *argv[])
+{
+  const char *address = "127.0.0.1", *greeting = NULL;
+  int port = DEFAULT_PORT, opt, lfd, sig_fd, one = 1;
+  struct sockaddr_in addr;
+  struct epoll_event ev = {.events = EPOLLIN};
+  sigset_t sigs;
+
+  while ((opt = getopt(argc, argv, "a:p:g:h")) != -1)
+  {
+    switch (opt)
+    {
+    case 'a':
+      address = optarg;
+      break;
+    case 'p':
+      if ((port = parsePort(optarg)) < 0)
+      {
+        usage(argv[0]);
+        exit(1);
+      }
+      break;
+    case 'g':
+      greeting = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      exit(opt == 'h' ? 0 : 1);
+    }
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if (inet_pton(AF_INET, address, &addr.sin_addr) <= 0)
+  {
+    fprintf(stderr, "chatserver: bad address \"%s\"\n", address);
+    exit(1);
+  }
+  if ((lfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0 ||
+      setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+      bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(lfd, SOMAXCONN) < 0)
+  {
+    perror("chatserver: listen");
+    exit(1);
+  }
+
+  sigemptyset(&sigs);
+  sigaddset(&sigs, SIGINT);
+  sigaddset(&sigs, SIGTERM);
+  sigprocmask(SIG_BLOCK, &sigs, NULL);
+  if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+      (sig_fd = signalfd(-1, &sigs, SFD_CLOEXEC)) < 0)
+  {
+    perror("chatserver: setup");
+    exit(1);
+  }
+  ev.data.fd = lfd;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, lfd, &ev);
+  ev.data.fd = sig_fd;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, sig_fd, &ev);
+  fprintf(stderr, "chatserver: listening on %s:%d\n", address, port);
+
+  for (;;)
+  {
+    struct epoll_event events[MAX_EVENTS];
+    int n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      break;
+    for (int i = 0; i < n; i++)
+    {
+      int fd = events[i].data.fd;
+      struct client *c;
+
+      if (fd == sig_fd)
+      {
+        fprintf(stderr, "chatserver: %llu lines in, %llu bytes out, %llu slow clients dropped\n",
+                (unsigned long long)lines_in, (unsigned long long)bytes_out,
+                (unsigned long long)dropped_clients);
+        return 0;
+      }
+      if (fd == lfd)
+      {
+        acceptClients(lfd, greeting);
+        continue;
+      }
+      /* An earlier event in this batch may have dropped the client */
+      if ((c = by_fd[fd]) == NULL)
+        continue;
+      if ((events[i].events & EPOLLOUT) && flushClient(c) < 0)
+      {
+        dropClient(c);
+        continue;
+      }
+      if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && readClient(c) < 0)
+        dropClient(c);
+    }
+  }
+  perror("chatserver: epoll_wait");
+  return 1;
+}
@@ -0,0 +1,360 @@
+/*
+ * editor: applies keyboard reports to the message box
+ *
+ * Everything here runs on the main loop thread, so none of it needs a lock.
+ */
+#include "editor.h"
+#include "metrics.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Start with an empty message box.  history_path is the file sent
+ * messages are kept in across runs, or NULL.  Returns -1 if it couldn't
+ * be opened.
+ */
+int editorInit(struct editor *ed, const char *history_path)
+{
+  memset(ed, 0, sizeof(*ed));
+  ed->pos.cursor_col_indx = MESSAGE_BOX_START_COLS;
+  ed->pos.cursor_row_indx = MESSAGE_BOX_START_ROWS;
+  gapInit(&ed->msg);
+  gapInit(&ed->draft);
+  gapInit(&ed->aside);
+  undoInit(&ed->undo);
+  keymapInit(&ed->keymap);
+  return msgHistInit(&ed->history, history_path);
+}
+
+/*
+  Up on the first row of the message goes back to the previous message
+  sent, Down on its last row forward again.  Going back from a new
+  message puts it aside (swapping buffers, nothing copied), and going
+  forward past the last one sent brings it back.  Returns false if
+  there is nothing further that way, so the arrow just moves the cursor.
+*/
+static bool recall(struct editor *ed)
+{
+  size_t cursor = gapCursor(&ed->msg), len;
+  size_t want = ed->recalled;
+  struct gap_buffer swap;
+  const char *text;
+
+  if (s_keys.up_arrow && cursor < MAX_COLS && ed->recalled < ed->history.count)
+    want++;
+  else if (s_keys.down_arrow && cursor / MAX_COLS == gapLength(&ed->msg) / MAX_COLS &&
+           ed->recalled > 0)
+    want--;
+  else
+    return false;
+
+  if (ed->recalled == 0)
+  {
+    swap = ed->draft;
+    ed->draft = ed->msg;
+    ed->msg = swap;
+  }
+  if (want == 0)
+  {
+    gapFree(&ed->msg);
+    ed->msg = ed->draft;
+    gapInit(&ed->draft);
+  }
+  else
+  {
+    text = msgHistGet(&ed->history, want, &len);
+    gapLoad(&ed->msg, text, len);
+  }
+  ed->recalled = want;
+  undoInit(&ed->undo); /* Its edits were to the message that was there */
+  redrawMessage(&ed->pos, &ed->msg);
+  return true;
+}
+
+/*
+  Take the cursor down for an edit that moves it.  The keystroke isn't
+  on screen until the cursor is back up at its new spot, so its latency
+  sample is held back from the redraws in between and handed to
+  cursorUp().
+*/
+static uint64_t cursorDown(struct editor *ed)
+{
+  uint64_t stamp = ed->pos.input_stamp;
+
+  ed->pos.input_stamp = 0;
+  if (ed->pos.blinking)
+    handleCursorBlink(&ed->pos, &ed->msg);
+  return stamp;
+}
+
+static void cursorUp(struct editor *ed, uint64_t stamp)
+{
+  if (stamp)
+    ed->pos.input_stamp = stamp;
+  handleCursorBlink(&ed->pos, &ed->msg);
+}
+
+/*
+  Run the held arrow/backspace action.  The cursor is taken down before
+  it moves and put straight back up at the new spot so the move shows
+  now instead of at the next blink.
+*/
+void editorHeldKeys(struct editor *ed)
+{
+  uint64_t stamp = cursorDown(ed);
+
+  if (ARROW_KEYS_PRESSED(s_keys))
+  {
+    if (ed->searching || !recall(ed))
+      handleArrowKeys(&ed->pos, &ed->msg, &s_keys);
+  }
+  else if (BACKSPACE_PRESSED(s_keys))
+    handleBackSpace(&ed->pos, &ed->msg, &ed->undo);
+  cursorUp(ed, stamp);
+}
+
+void editorBlink(struct editor *ed)
+{
+  handleCursorBlink(&ed->pos, &ed->msg);
+}
+
+/*
+ * Ctrl+Z: undo the last run of edits.  Ctrl+Y (redo true): do again what
+ * was last undone.  Either redraws only what it changed.
+ */
+void editorUndo(struct editor *ed, bool redo)
+{
+  struct gap_range changed;
+  uint64_t stamp = cursorDown(ed);
+  bool applied;
+
+  if (redo)
+    applied = undoReapply(&ed->undo, &ed->msg, &changed);
+  else
+    applied = undoRevert(&ed->undo, &ed->msg, &changed);
+  if (applied)
+    redrawMessageRange(&ed->pos, &ed->msg, &changed);
+  cursorUp(ed, stamp);
+}
+
+/*
+  Count n characters typed, for the typing rate.
+*/
+static void countTyped(size_t n)
+{
+  uint64_t now = monotonicNs();
+
+  if (typed_chars == 0)
+    typing_start_ns = now;
+  typing_end_ns = now;
+  typed_chars += n;
+}
+
+static void typeKey(struct editor *ed, const struct key_binding *b)
+{
+  printChar(&ed->pos, &s_keys, &ed->msg, &ed->undo, b->ch);
+  countTyped(1);
+}
+
+static void tabKey(struct editor *ed, const struct key_binding *b)
+{
+  for (int i = 0; i < TAB_SPACING; i++)
+    printChar(&ed->pos, &s_keys, &ed->msg, &ed->undo, ' ');
+  countTyped(TAB_SPACING);
+}
+
+static void sendKey(struct editor *ed, const struct key_binding *b)
+{
+  if (ed->searching)
+  {
+    /* Nothing to send: look for the query instead */
+    if (ed->app_action)
+      ed->app_action(ACT_FIND_OLDER);
+    return;
+  }
+  if (!handleEnterKey(&ed->pos, &ed->msg, &ed->history))
+    return;
+  gapFree(&ed->draft);
+  undoInit(&ed->undo);
+  ed->recalled = 0;
+}
+
+static void undoKey(struct editor *ed, const struct key_binding *b)
+{
+  editorUndo(ed, b->action == ACT_REDO);
+}
+
+static void toggleKey(struct editor *ed, const struct key_binding *b)
+{
+  if (b->action == ACT_INSERT)
+    s_keys.insert = !s_keys.insert;
+  else
+    s_keys.caps_lock = !s_keys.caps_lock;
+}
+
+/*
+  Ctrl+F: the message box becomes where the search query is typed,
+  with the message put aside (and undo starting over) until it is
+  pressed again.  Finding is up to the main loop.
+*/
+static void searchKey(struct editor *ed, const struct key_binding *b)
+{
+  struct gap_buffer swap = ed->aside;
+
+  ed->aside = ed->msg;
+  ed->msg = swap;
+  if (ed->searching)
+    gapFree(&ed->aside); /* The query */
+  ed->searching = !ed->searching;
+  undoInit(&ed->undo);
+  redrawMessage(&ed->pos, &ed->msg);
+  if (ed->app_action)
+    ed->app_action(b->action);
+}
+
+/* Not the editor's to do: the main loop's */
+static void appKey(struct editor *ed, const struct key_binding *b)
+{
+  if (ed->app_action)
+    ed->app_action(b->action);
+}
+
+/*
+  What each action does when its key goes down.  Arrow keys and
+  backspace don't run anything here: they set their HELD_* bit, act
+  through editorHeldKeys() and then repeat while held.
+*/
+static const struct
+{
+  void (*run)(struct editor *ed, const struct key_binding *b);
+  uint8_t held; /* HELD_* bit */
+  bool draws;   /* Changes the message box, so the keystroke is timed */
+} actions[ACT_COUNT] = {
+    [ACT_NONE] = {NULL, 0, false},
+    [ACT_TYPE] = {typeKey, 0, true},
+    [ACT_SEND] = {sendKey, 0, true},
+    [ACT_BACKSPACE] = {NULL, HELD_BACKSPACE, true},
+    [ACT_TAB] = {tabKey, 0, true},
+    [ACT_LEFT] = {NULL, HELD_LEFT, true},
+    [ACT_RIGHT] = {NULL, HELD_RIGHT, true},
+    [ACT_UP] = {NULL, HELD_UP, true},
+    [ACT_DOWN] = {NULL, HELD_DOWN, true},
+    [ACT_UNDO] = {undoKey, 0, true},
+    [ACT_REDO] = {undoKey, 0, true},
+    [ACT_INSERT] = {toggleKey, 0, false},
+    [ACT_CAPS_LOCK] = {toggleKey, 0, false},
+    [ACT_PAGE_UP] = {appKey, 0, false},
+    [ACT_PAGE_DOWN] = {appKey, 0, false},
+    [ACT_QUIT] = {appKey, 0, false},
+    [ACT_SEARCH] = {searchKey, 0, true},
+    [ACT_FIND_OLDER] = {appKey, 0, false},
+    [ACT_FIND_NEWER] = {appKey, 0, false},
+};
+
+static bool newlyPressed(const struct editor *ed, uint8_t keycode)
+{
+  return keycode != 0 && memchr(ed->old_keys, keycode, sizeof(ed->old_keys)) == NULL;
+}
+
+/*
+  Apply one keyboard report.  Each key down is looked up in the keymap
+  and its action run on the press that introduces it; arrow keys and
+  backspace act once when they go down (the caller repeats them while
+  ed->held says they are still down).
+*/
+void editorApplyReport(struct editor *ed, const struct key_report *report)
+{
+  struct usb_keyboard_packet packet = report->packet;
+  const struct key_binding *b;
+  bool timed = false;
+  uint8_t held = 0;
+
+  sprintf(ed->keystate, "%02x %02x %02x", packet.modifiers, packet.keycode[0],
+          packet.keycode[1]);
+  if (!ed->pos.deferred)
+    fbputs(ed->keystate, 6, 0);
+
+  for (int i = 0; i < MAX_KEYS_PRESSED; i++)
+  {
+    if (packet.keycode[i] == 0)
+      continue;
+    b = keymapLookup(&ed->keymap, packet.modifiers, s_keys.caps_lock, packet.keycode[i]);
+    held |= actions[b->action].held;
+    timed |= newlyPressed(ed, packet.keycode[i]) && actions[b->action].draws;
+  }
+  s_keys.left_arrow = held & HELD_LEFT;
+  s_keys.right_arrow = held & HELD_RIGHT;
+  s_keys.up_arrow = held & HELD_UP;
+  s_keys.down_arrow = held & HELD_DOWN;
+  s_keys.backspace_pressed = held & HELD_BACKSPACE;
+
+  /* Carry the arrival time to whichever draw puts this keystroke on screen */
+  if (timed && !ed->pos.input_stamp)
+    ed->pos.input_stamp = report->arrived_ns;
+
+  if (held & ~ed->held)
+    editorHeldKeys(ed);
+  ed->held = held;
+
+  for (int i = 0; i < MAX_KEYS_PRESSED; i++)
+  {
+    if (!newlyPressed(ed, packet.keycode[i]))
+      continue;
+    b = keymapLookup(&ed->keymap, packet.modifiers, s_keys.caps_lock, packet.keycode[i]);
+    if (actions[b->action].run)
+      actions[b->action].run(ed, b);
+  }
+  if (!ed->pos.deferred)
+    printSpecialKeys(&s_keys);
+
+  memcpy(ed->old_keys, packet.keycode, sizeof(packet.keycode));
+  histRecord(&input_latency, monotonicNs() - report->arrived_ns);
+}
+
+/*
+ * Several reports are waiting: apply them all before drawing anything
+ * (key state and debug lines included), then draw once with
+ * editorEndBurst().  A paste or a fast typist costs one repaint of the
+ * cells that changed rather than one per character.
+ */
+void editorBeginBurst(struct editor *ed)
+{
+  beginMessageBurst(&ed->pos, &ed->msg);
+  input_bursts++;
+}
+
+void editorEndBurst(struct editor *ed)
+{
+  endMessageBurst(&ed->pos, &ed->msg);
+  fbputs(ed->keystate, 6, 0);
+  printSpecialKeys(&s_keys);
+}
+
+/*
+  Debug print for special characters on screen
+*/
+void printSpecialKeys(struct special_keys *s_keys)
+{
+  char caps_insert[15];
+  sprintf(caps_insert, "CAPS LOCK %d", s_keys->caps_lock);
+  fbputs(caps_insert, 1, 50);
+
+  sprintf(caps_insert, "INSERT %d", s_keys->insert);
+  fbputs(caps_insert, 2, 50);
+
+  sprintf(caps_insert, "BACKSPACE %d", s_keys->backspace_pressed);
+  fbputs(caps_insert, 3, 50);
+
+  sprintf(caps_insert, "LEFT ARROW %d", s_keys->left_arrow);
+  fbputs(caps_insert, 4, 50);
+
+  sprintf(caps_insert, "UP ARROW %d", s_keys->up_arrow);
+  fbputs(caps_insert, 5, 50);
+
+  sprintf(caps_insert, "DOWN_ARROW %d", s_keys->down_arrow);
+  fbputs(caps_insert, 6, 50);
+
+  sprintf(caps_insert, "RIGHT ARROW %d", s_keys->right_arrow);
+  fbputs(caps_insert, 7, 50);
+}
@@ -0,0 +1,46 @@
+#ifndef _EDITOR_H
+#define _EDITOR_H
+
+#include "fbputchar.h"
+#include "usbkeyboard.h"
+#include "inputqueue.h"
+#include "keymap.h"
+
+/* Keys that act when pressed and then repeat while held */
+#define HELD_LEFT (1 << 0)
+#define HELD_RIGHT (1 << 1)
+#define HELD_UP (1 << 2)
+#define HELD_DOWN (1 << 3)
+#define HELD_BACKSPACE (1 << 4)
+
+/*
+ * The message box editor.  Owned by the main loop thread: nothing else
+ * touches it (or s_keys), other threads only send it key_reports through
+ * the input queue.
+ */
+struct editor
+{
+  struct position pos;
+  struct gap_buffer msg; /* The message being typed */
+  struct gap_buffer draft; /* What was being typed before recalling history */
+  struct msghist history;
+  struct undo_log undo;    /* Edits to msg */
+  size_t recalled;         /* Which history entry msg came from, 0 if none */
+  bool searching;          /* msg is a search query */
+  struct gap_buffer aside; /* The message while searching */
+  struct keymap keymap;
+  void (*app_action)(enum key_action action); /* Runs the actions the editor doesn't own */
+  char old_keys[MAX_KEYS_PRESSED];
+  char keystate[12];
+  uint8_t held; /* HELD_* bits from the last report */
+};
+
+extern int editorInit(struct editor *ed, const char *history_path);
+extern void editorApplyReport(struct editor *ed, const struct key_report *report);
+extern void editorHeldKeys(struct editor *ed);
+extern void editorBlink(struct editor *ed);
+extern void editorUndo(struct editor *ed, bool redo);
+extern void editorBeginBurst(struct editor *ed);
+extern void editorEndBurst(struct editor *ed);
+extern void printSpecialKeys(struct special_keys *s_keys);
+#endif
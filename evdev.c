@@ -0,0 +1,282 @@
+/*
+ * evdev: keyboard backend reading /dev/input/event* through epoll
+ *
+ * References:
+ *
+ * https://www.kernel.org/doc/html/latest/input/input.html
+ * https://www.kernel.org/doc/html/latest/input/event-codes.html
+ */
+#include "evdev.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+
+#define BITS_PER_LONG (sizeof(long) * 8)
+#define NLONGS(x) (((x) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+#define TEST_BIT(bit, array) ((array[(bit) / BITS_PER_LONG] >> ((bit) % BITS_PER_LONG)) & 1)
+
+/*
+  HID usage -> Linux keycode for the keyboard page, from the kernel's
+  hid_keyboard[] table (drivers/hid/hid-input.c).  Index is the HID code.
+*/
+static const uint8_t hid_to_evdev[] = {
+    0, 0, 0, 0, 30, 48, 46, 32, 18, 33, 34, 35, 23, 36, 37, 38,
+    50, 49, 24, 25, 16, 19, 31, 20, 22, 47, 17, 45, 21, 44, 2, 3,
+    4, 5, 6, 7, 8, 9, 10, 11, 28, 1, 14, 15, 57, 12, 13, 26,
+    27, 43, 43, 39, 40, 41, 51, 52, 53, 58, 59, 60, 61, 62, 63, 64,
+    65, 66, 67, 68, 87, 88, 99, 70, 119, 110, 102, 104, 111, 107, 109, 106,
+    105, 108, 103, 69, 98, 55, 74, 78, 96, 79, 80, 81, 75, 76, 77, 71,
+    72, 73, 82, 83, 86, 127};
+
+static uint8_t evdev_to_hid[KEY_CNT];
+
+static uint8_t modifierBit(uint16_t code)
+{
+  switch (code)
+  {
+  case KEY_LEFTCTRL: return USB_LCTRL;
+  case KEY_LEFTSHIFT: return USB_LSHIFT;
+  case KEY_LEFTALT: return USB_LALT;
+  case KEY_LEFTMETA: return USB_LGUI;
+  case KEY_RIGHTCTRL: return USB_RCTRL;
+  case KEY_RIGHTSHIFT: return USB_RSHIFT;
+  case KEY_RIGHTALT: return USB_RALT;
+  case KEY_RIGHTMETA: return USB_RGUI;
+  default: return 0;
+  }
+}
+
+/*
+  True if the device reports letter keys and Enter, i.e. it's a keyboard
+  and not a power button or a mouse with a few buttons.
+*/
+static bool isKeyboard(int fd)
+{
+  unsigned long evbits[NLONGS(EV_CNT)] = {0};
+  unsigned long keybits[NLONGS(KEY_CNT)] = {0};
+
+  if (ioctl(fd, EVIOCGBIT(0, sizeof(evbits)), evbits) < 0 || !TEST_BIT(EV_KEY, evbits))
+    return false;
+  if (ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(keybits)), keybits) < 0)
+    return false;
+  return TEST_BIT(KEY_A, keybits) && TEST_BIT(KEY_Z, keybits) && TEST_BIT(KEY_ENTER, keybits);
+}
+
+static int addDevice(struct evdev_keyboard *kb, const char *path)
+{
+  struct epoll_event ev;
+  int clk = CLOCK_MONOTONIC;
+  int fd;
+
+  if (kb->num_fds == EVDEV_MAX_DEVICES)
+    return -1;
+  if ((fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC)) < 0)
+    return -1;
+  if (!isKeyboard(fd))
+  {
+    close(fd);
+    return -1;
+  }
+  /* Event timestamps on the same clock as monotonicNs() */
+  ioctl(fd, EVIOCSCLOCKID, &clk);
+
+  ev.events = EPOLLIN;
+  ev.data.fd = fd;
+  if (epoll_ctl(kb->epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+  {
+    close(fd);
+    return -1;
+  }
+  kb->fds[kb->num_fds++] = fd;
+  return 0;
+}
+
+static void removeDevice(struct evdev_keyboard *kb, int fd)
+{
+  epoll_ctl(kb->epfd, EPOLL_CTL_DEL, fd, NULL);
+  close(fd);
+  for (int i = 0; i < kb->num_fds; i++)
+    if (kb->fds[i] == fd)
+    {
+      kb->fds[i] = kb->fds[--kb->num_fds];
+      break;
+    }
+}
+
+/*
+ * Open the given event device, or every keyboard under /dev/input when
+ * device is NULL.  Returns 0 on success, -1 if no keyboard was found.
+ */
+int evdevOpen(struct evdev_keyboard *kb, const char *device)
+{
+  char path[280];
+  struct dirent *de;
+  DIR *dir;
+
+  memset(kb, 0, sizeof(*kb));
+  for (uint16_t hid = 0; hid < sizeof(hid_to_evdev); hid++)
+    if (hid_to_evdev[hid] && !evdev_to_hid[hid_to_evdev[hid]])
+      evdev_to_hid[hid_to_evdev[hid]] = hid;
+
+  if ((kb->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    return -1;
+
+  if (device != NULL)
+    addDevice(kb, device);
+  else if ((dir = opendir(EVDEV_INPUT_DIR)) != NULL)
+  {
+    while ((de = readdir(dir)) != NULL)
+    {
+      if (strncmp(de->d_name, "event", 5) != 0)
+        continue;
+      snprintf(path, sizeof(path), "%s/%s", EVDEV_INPUT_DIR, de->d_name);
+      addDevice(kb, path);
+    }
+    closedir(dir);
+  }
+
+  if (kb->num_fds == 0)
+  {
+    close(kb->epfd);
+    return -1;
+  }
+  return 0;
+}
+
+/*
+  Fold one EV_KEY event into the held-key report.
+*/
+static void applyKey(struct evdev_keyboard *kb, const struct input_event *ev)
+{
+  uint8_t bit = modifierBit(ev->code);
+  uint8_t hid = ev->code < KEY_CNT ? evdev_to_hid[ev->code] : 0;
+  int i;
+
+  if (bit)
+  {
+    if (ev->value)
+      kb->state.modifiers |= bit;
+    else
+      kb->state.modifiers &= ~bit;
+    kb->dirty = true;
+    return;
+  }
+  if (!hid)
+    return;
+
+  for (i = 0; i < MAX_KEYS_PRESSED && kb->state.keycode[i] != hid; i++)
+    ;
+  if (ev->value == 0 && i < MAX_KEYS_PRESSED)
+  {
+    /* Release: close the gap so keys stay in press order */
+    memmove(&kb->state.keycode[i], &kb->state.keycode[i + 1], MAX_KEYS_PRESSED - i - 1);
+    kb->state.keycode[MAX_KEYS_PRESSED - 1] = 0;
+  }
+  else if (ev->value == 1 && i == MAX_KEYS_PRESSED)
+  {
+    for (i = 0; i < MAX_KEYS_PRESSED && kb->state.keycode[i]; i++)
+      ;
+    if (i < MAX_KEYS_PRESSED)
+      kb->state.keycode[i] = hid;
+  }
+  else if (ev->value == 2)
+    kb->repeat_code = hid;
+  else
+    return;
+  kb->dirty = true;
+}
+
+/*
+  Wait for any device to become readable and read whatever it has.
+  Returns -1 once every device has gone away.
+*/
+static int refill(struct evdev_keyboard *kb)
+{
+  struct epoll_event ready[EVDEV_MAX_DEVICES];
+  int n, i;
+  ssize_t r;
+
+  kb->ev_pos = kb->ev_len = 0;
+  while (kb->ev_len == 0)
+  {
+    if (kb->num_fds == 0)
+      return -1;
+    if ((n = epoll_wait(kb->epfd, ready, EVDEV_MAX_DEVICES, -1)) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    for (i = 0; i < n && kb->ev_len < EVDEV_EVENT_BUFFER; i++)
+    {
+      r = read(ready[i].data.fd, kb->evbuf + kb->ev_len,
+               (EVDEV_EVENT_BUFFER - kb->ev_len) * sizeof(struct input_event));
+      if (r > 0)
+        kb->ev_len += r / sizeof(struct input_event);
+      else if (r == 0 || (errno != EAGAIN && errno != EINTR))
+        removeDevice(kb, ready[i].data.fd); /* Unplugged */
+    }
+  }
+  return 0;
+}
+
+/*
+ * Block until the held keys change and return them as a HID report.
+ * A kernel auto-repeat is delivered as a release followed by a press of
+ * that key so it looks like a new keystroke downstream.  Returns 1 with
+ * packet filled in, 0 if no keyboard is left.
+ */
+int evdevNextPacket(struct evdev_keyboard *kb, struct usb_keyboard_packet *packet)
+{
+  for (;;)
+  {
+    if (kb->repeat_pending)
+    {
+      kb->repeat_pending = false;
+      *packet = kb->state;
+      return 1;
+    }
+    while (kb->ev_pos < kb->ev_len)
+    {
+      const struct input_event *ev = &kb->evbuf[kb->ev_pos++];
+      if (ev->type == EV_KEY)
+      {
+        uint64_t stamp = (uint64_t)ev->input_event_sec * 1000000000ULL +
+                         (uint64_t)ev->input_event_usec * 1000ULL;
+        uint64_t now = monotonicNs();
+        histRecord(&kb->latency, now > stamp ? now - stamp : 0);
+        applyKey(kb, ev);
+      }
+      else if (ev->type == EV_SYN && ev->code == SYN_REPORT && kb->dirty)
+      {
+        kb->dirty = false;
+        *packet = kb->state;
+        if (kb->repeat_code)
+        {
+          for (int i = 0; i < MAX_KEYS_PRESSED; i++)
+            if (packet->keycode[i] == kb->repeat_code)
+              packet->keycode[i] = 0;
+          kb->repeat_code = 0;
+          kb->repeat_pending = true;
+        }
+        return 1;
+      }
+    }
+    if (refill(kb) < 0)
+      return 0;
+  }
+}
+
+void evdevClose(struct evdev_keyboard *kb)
+{
+  while (kb->num_fds > 0)
+    removeDevice(kb, kb->fds[0]);
+  close(kb->epfd);
+}
@@ -0,0 +1,38 @@
+#ifndef _EVDEV_H
+#define _EVDEV_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <linux/input.h>
+#include "usbkeyboard.h"
+#include "metrics.h"
+
+/*
+ * Keyboard input through the kernel's evdev interface instead of libusb.
+ * Events are decoded by the kernel (so Bluetooth, PS/2 and uinput
+ * keyboards all work and the console keeps its driver) and turned back
+ * into usb_keyboard_packet reports so the rest of the program doesn't
+ * care which source is in use.
+ */
+#define EVDEV_INPUT_DIR "/dev/input"
+#define EVDEV_MAX_DEVICES 16
+#define EVDEV_EVENT_BUFFER 64
+
+struct evdev_keyboard
+{
+  int epfd;
+  int fds[EVDEV_MAX_DEVICES];
+  int num_fds;
+  struct input_event evbuf[EVDEV_EVENT_BUFFER];
+  int ev_pos, ev_len;
+  struct usb_keyboard_packet state; /* Keys currently held, as a HID report */
+  bool dirty;                       /* state changed since the last SYN_REPORT */
+  uint8_t repeat_code;              /* HID code the kernel auto-repeated */
+  bool repeat_pending;              /* Re-press of repeat_code still to deliver */
+  struct histogram latency;          /* Kernel timestamp to read(), per key event */
+};
+
+extern int evdevOpen(struct evdev_keyboard *kb, const char *device);
+extern int evdevNextPacket(struct evdev_keyboard *kb, struct usb_keyboard_packet *packet);
+extern void evdevClose(struct evdev_keyboard *kb);
+#endif
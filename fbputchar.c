@@ -10,6 +10,7 @@
  */
 
 #include "fbputchar.h"
+#include "metrics.h"
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -57,10 +58,10 @@ int fbopen()
 }
 
 /*
- * Draw the given character at the given row/column.
- * fbopen() must be called first.
- */
-void fbputchar(char c, int row, int col)
+  Draw character c at row/col with the pixels of the glyph in grey level
+  fg and the rest in bg.
+*/
+static void drawChar(char c, int row, int col, unsigned char fg, unsigned char bg)
 {
   int x, y;
   unsigned char pixels, *pixelp = font + FONT_HEIGHT * c;
@@ -77,31 +78,31 @@ void fbputchar(char c, int row, int col)
     {
       if (pixels & mask)
       {
-        pixel[0] = 255; /* Red */
-        pixel[1] = 255; /* Green */
-        pixel[2] = 255; /* Blue */
+        pixel[0] = fg; /* Red */
+        pixel[1] = fg; /* Green */
+        pixel[2] = fg; /* Blue */
         pixel[3] = 0;
       }
       else
       {
-        pixel[0] = 0;
-        pixel[1] = 0;
-        pixel[2] = 0;
+        pixel[0] = bg;
+        pixel[1] = bg;
+        pixel[2] = bg;
         pixel[3] = 0;
       }
       pixel += 4;
       if (pixels & mask)
       {
-        pixel[0] = 255; /* Red */
-        pixel[1] = 255; /* Green */
-        pixel[2] = 255; /* Blue */
+        pixel[0] = fg; /* Red */
+        pixel[1] = fg; /* Green */
+        pixel[2] = fg; /* Blue */
         pixel[3] = 0;
       }
       else
       {
-        pixel[0] = 0;
-        pixel[1] = 0;
-        pixel[2] = 0;
+        pixel[0] = bg;
+        pixel[1] = bg;
+        pixel[2] = bg;
         pixel[3] = 0;
       }
       pixel += 4;
@@ -112,6 +113,23 @@ void fbputchar(char c, int row, int col)
   }
 }
 
+/*
+ * Draw the given character at the given row/column.
+ * fbopen() must be called first.
+ */
+void fbputchar(char c, int row, int col)
+{
+  drawChar(c, row, col, 255, 0);
+}
+
+/*
+ * The same, in reverse video: dark on light, to pick it out.
+ */
+void fbputcharInverse(char c, int row, int col)
+{
+  drawChar(c, row, col, 0, 255);
+}
+
 void fbline(char c, int row)
 {
   int i;
@@ -121,36 +139,18 @@ void fbline(char c, int row)
   }
 }
 
-void fbscroll(struct position *pos)
+/*
+ * Move text rows [top + n, bottom) up to top in one go.  The n rows left
+ * at the bottom keep their old pixels for the caller to redraw.
+ */
+void fbScrollRows(int top, int bottom, int n)
 {
-  unsigned char *textBox = framebuffer +
-                           (TEXT_BOX_START_ROWS * FONT_HEIGHT * 2 + fb_vinfo.yoffset) * fb_finfo.line_length +
-                           (TEXT_BOX_START_COLS * FONT_WIDTH * 2 + fb_vinfo.xoffset) * BITS_PER_PIXEL / 8;
-  unsigned char *newTextBox = framebuffer +
-                              ((TEXT_BOX_START_ROWS + 1) * FONT_HEIGHT * 2 + fb_vinfo.yoffset) * fb_finfo.line_length +
-                              (TEXT_BOX_START_COLS * FONT_WIDTH * 2 + fb_vinfo.xoffset) * BITS_PER_PIXEL / 8;
-  // Might break with different ROWS, COLS settings. Esp if MESSAGE_BOX_START_COLS > TEXT_BOX_START_BOLS
-  ssize_t textBoxSize = ((pos->msg_buff_row_indx - (TEXT_BOX_START_ROWS + 1)) *
-                             FONT_HEIGHT * 2 +
-                         fb_vinfo.yoffset) *
-                            fb_finfo.line_length +
-                        ((pos->msg_buff_col_indx - TEXT_BOX_START_COLS) * FONT_WIDTH * 2 + fb_vinfo.xoffset) * BITS_PER_PIXEL / 8;
-
-  memmove(textBox, newTextBox, textBoxSize);
-  fbline(' ', pos->msg_buff_row_indx - 1);
-  // for (int i = pos->msg_buff_col_indx; i < MAX_COLS; i++) {
-  //   fbputchar(' ', pos->msg_buff_row_indx - 1, i);
-  // }
-  pos->msg_buff_row_indx--;
-  pos->msg_buff_col_indx = TEXT_BOX_START_COLS;
-}
+  size_t row_bytes = (size_t)FONT_HEIGHT * 2 * fb_finfo.line_length;
+  unsigned char *dst = framebuffer + (top * FONT_HEIGHT * 2 + fb_vinfo.yoffset) * fb_finfo.line_length;
 
-void clearTextBox()
-{
-  for (int i = TEXT_BOX_START_ROWS; i < MESSAGE_BOX_START_ROWS - 1; i++)
-  {
-    fbline(' ', i);
-  }
+  if (n <= 0 || n >= bottom - top)
+    return;
+  memmove(dst, dst + n * row_bytes, (bottom - top - n) * row_bytes);
 }
 
 void clearScreen()
@@ -173,385 +173,286 @@ void fbputs(const char *s, int row, int col)
 }
 
 /*
-  Handles wrap around
+  The keystroke pending on pos (if any) is now visible: record how long
+  it took from report arrival to pixels.
 */
-// void fbPutString(const char *s, struct position *text_pos)
-// {
-//   // this is the code causing wird block
-//   char c;
-//   // for each char in the string
-//   while ((c = *s++) != 0)
-//   {
-//     // return when we hit end of string
-//     if (c == '\n')
-//     {
-//       text_pos->msg_buff_col_indx = TEXT_BOX_START_COLS;
-//       text_pos->msg_buff_row_indx++;
-//       // newLined = true;
-//       continue;
-//     }
-//     // if we reach the end of the text box call scroll
-//     if ((text_pos->msg_buff_row_indx >= TEXT_BOX_END_ROWS))
-//     {
-//       fbscroll(text_pos); // Need to check... yup
-//     }
-//     // if hit the end of the screen wrap around
-//     else if (text_pos->msg_buff_col_indx == MAX_COLS)
-//     {
-//       text_pos->msg_buff_col_indx = TEXT_BOX_START_COLS;
-//       text_pos->msg_buff_row_indx++;
-//     }
-//     fbputchar(c, text_pos->msg_buff_row_indx, text_pos->msg_buff_col_indx);
-//     text_pos->msg_buff_col_indx++;
-//   }
-// }
+static void markDrawn(struct position *pos)
+{
+  if (pos->input_stamp && !pos->deferred)
+  {
+    histRecord(&keystroke_latency, monotonicNs() - pos->input_stamp);
+    pos->input_stamp = 0;
+  }
+}
 
-void fbPutString(const char *s, struct position *text_pos)
+/*
+  Screen cell of message character i, if the message box is showing it.
+*/
+static bool messageCell(const struct position *pos, size_t i, uint8_t *row, uint8_t *col)
 {
-  char c;
-  // for each char in the string
-  while ((c = *s++) != 0)
+  size_t msg_row = i / MAX_COLS;
+
+  if (msg_row < pos->msg_top_row || msg_row >= pos->msg_top_row + MESSAGE_BOX_ROWS)
+    return false;
+  *row = MESSAGE_BOX_START_ROWS + (msg_row - pos->msg_top_row);
+  *col = MESSAGE_BOX_START_COLS + i % MAX_COLS;
+  return true;
+}
+
+/*
+  Redraw characters [from, to) of the message where the box shows them;
+  cells past the end of the message are blanked.  However long the
+  message, no more than a box full is drawn.
+*/
+static void drawRange(const struct position *pos, const struct gap_buffer *msg,
+                      size_t from, size_t to)
+{
+  size_t len = gapLength(msg);
+  size_t first = pos->msg_top_row * MAX_COLS;
+  size_t last = first + MESSAGE_BOX_ROWS * MAX_COLS;
+  uint8_t row, col;
+
+  if (from < first)
+    from = first;
+  if (to > last)
+    to = last;
+  for (size_t i = from; i < to; i++)
   {
-    // return when we hit end of string
-    // or f hit the end of the screen wrap around
-    if (c == '\n')
-    {
-      text_pos->msg_buff_col_indx = TEXT_BOX_START_COLS;
-      text_pos->msg_buff_row_indx++;
-    }
-    if (text_pos->msg_buff_col_indx == MAX_COLS)
-    {
-      text_pos->msg_buff_col_indx = TEXT_BOX_START_COLS;
-      text_pos->msg_buff_row_indx++;
-    }
-    // if we reach the end of the text box call scroll
-    if ((text_pos->msg_buff_row_indx >= TEXT_BOX_END_ROWS))
-    {
-      // need to set text_pos->msg_buff_row_indx to not grab line
-      fbscroll(text_pos); // Need to check... yup
-    }
-    if (c != '\n')
-    {
-      fbputchar(c, text_pos->msg_buff_row_indx, text_pos->msg_buff_col_indx);
-      text_pos->msg_buff_col_indx++;
-    }
+    messageCell(pos, i, &row, &col);
+    fbputchar(i < len ? gapCharAt(msg, i) : ' ', row, col);
+  }
+  if (to > from)
+    message_cells_drawn += to - from;
+}
+
+/*
+  In a burst, note that characters [from, to) need redrawing and return
+  true: the caller draws nothing now.
+*/
+static bool deferDraw(struct position *pos, size_t from, size_t to)
+{
+  if (!pos->deferred)
+    return false;
+  if (from < to && from < pos->dirty.from)
+    pos->dirty.from = from;
+  if (from < to && to > pos->dirty.to)
+    pos->dirty.to = to;
+  return true;
+}
+
+/*
+  Put the cursor on screen at its place in the message, scrolling the
+  box (and redrawing all of it) when that row isn't showing.  Returns
+  true if it scrolled.
+*/
+static bool placeCursor(struct position *pos, const struct gap_buffer *msg)
+{
+  size_t cursor = gapCursor(msg);
+  size_t msg_row = cursor / MAX_COLS;
+  size_t top = pos->msg_top_row;
+  bool scrolled;
+
+  if (msg_row < top)
+    top = msg_row;
+  else if (msg_row >= top + MESSAGE_BOX_ROWS)
+    top = msg_row - MESSAGE_BOX_ROWS + 1;
+  scrolled = top != pos->msg_top_row;
+  if (scrolled)
+  {
+    pos->msg_top_row = top;
+    drawRange(pos, msg, 0, SIZE_MAX);
   }
+  messageCell(pos, cursor, &pos->cursor_row_indx, &pos->cursor_col_indx);
+  return scrolled;
+}
+
+/*
+  The whole message was replaced: show it from the top, or as much of
+  its end as keeps the cursor in view.
+*/
+void redrawMessage(struct position *pos, const struct gap_buffer *msg)
+{
+  pos->msg_top_row = 0;
+  if (deferDraw(pos, 0, SIZE_MAX))
+    return;
+  if (!placeCursor(pos, msg))
+    drawRange(pos, msg, 0, SIZE_MAX);
+  markDrawn(pos);
+}
+
+/*
+  Part of the message changed: redraw that part, and move the cursor to
+  where the edit left it.
+*/
+void redrawMessageRange(struct position *pos, const struct gap_buffer *msg,
+                        const struct gap_range *changed)
+{
+  if (deferDraw(pos, changed->from, changed->to))
+    return;
+  if (!placeCursor(pos, msg))
+    drawRange(pos, msg, changed->from, changed->to);
+  markDrawn(pos);
 }
 
 /*
   handles arrow keys
   (assumed safe)
 */
-void handleArrowKeys(struct position *pos, struct special_keys *s_keys)
+void handleArrowKeys(struct position *pos, struct gap_buffer *msg, struct special_keys *s_keys)
 {
+  size_t cursor = gapCursor(msg), len = gapLength(msg);
+
   if (s_keys->left_arrow)
   {
-    if (pos->cursor_col_indx == 0 && pos->cursor_row_indx == MESSAGE_BOX_START_ROWS)
-    {
-      return;
-    }
-    else if (pos->cursor_col_indx == 0)
-    {
-      pos->cursor_col_indx = MAX_COLS - 1;
-      pos->cursor_row_indx--;
-      pos->cursor_buff_indx--;
-    }
-    else
-    {
-      pos->cursor_col_indx--;
-      pos->cursor_buff_indx--;
-    }
+    if (cursor > 0)
+      cursor--;
   }
   else if (s_keys->right_arrow)
   {
-    if (pos->cursor_col_indx == pos->msg_buff_col_indx && pos->cursor_row_indx == pos->msg_buff_row_indx)
-      return;
-    else if (pos->cursor_col_indx == MAX_COLS)
-    {
-      pos->cursor_col_indx = 0;
-      pos->cursor_row_indx++;
-      pos->cursor_buff_indx++;
-    }
-    else
-    {
-      pos->cursor_col_indx++;
-      pos->cursor_buff_indx++;
-    }
+    if (cursor < len)
+      cursor++;
   }
   else if (s_keys->down_arrow)
-  {
-    if (pos->msg_buff_indx - pos->cursor_buff_indx >= MAX_COLS)
-    {
-      pos->cursor_buff_indx += MAX_COLS;
-      pos->cursor_row_indx++;
-    }
-    else
-    {
-      pos->cursor_buff_indx = pos->msg_buff_indx;
-      pos->cursor_col_indx = pos->msg_buff_col_indx;
-      pos->cursor_row_indx = pos->msg_buff_row_indx;
-    }
-  }
+    cursor = len - cursor >= MAX_COLS ? cursor + MAX_COLS : len;
   else if (s_keys->up_arrow)
-  {
-    if (pos->cursor_row_indx == MESSAGE_BOX_START_ROWS)
-    {
-      pos->cursor_col_indx = 0;
-      pos->cursor_buff_indx = 0;
-    }
-    else
-    {
-      pos->cursor_row_indx--;
-      pos->cursor_buff_indx -= MAX_COLS;
-    }
-  }
+    cursor = cursor >= MAX_COLS ? cursor - MAX_COLS : 0;
+  gapMoveTo(msg, cursor);
+  if (!deferDraw(pos, 0, 0))
+    placeCursor(pos, msg);
 }
 
 /*
-  Handles return pressed send message, reset cursor and clear message box
+  Handles return pressed send message, remember it for recall, reset
+  cursor and clear message box.  Returns false, with the message left
+  as it was, if there was no room to send it
   (safe)
 */
-void handleEnterKey(struct position *pos)
+bool handleEnterKey(struct position *pos, struct gap_buffer *msg, struct msghist *hist)
 {
-  // send message
-  sendMsg();
+  size_t len;
+  const char *text;
+
+  // send message; with the queue full it stays in the box to try again
+  if (!sendMsg())
+  {
+    markDrawn(pos);
+    return false;
+  }
+  text = gapText(msg, &len);
+  msgHistAdd(hist, text, len);
 
   // reset message box and cursor
-  pos->msg_buff_col_indx = MESSAGE_BOX_START_COLS;
-  pos->msg_buff_row_indx = MESSAGE_BOX_START_ROWS;
-  pos->msg_buff_indx = 0; // Message is sent
-  pos->cursor_col_indx = MESSAGE_BOX_START_COLS;
-  pos->cursor_row_indx = MESSAGE_BOX_START_ROWS;
-  pos->cursor_buff_indx = 0;
+  gapFree(msg); // Message is sent
+  pos->msg_top_row = 0;
+  if (deferDraw(pos, 0, SIZE_MAX))
+    return true;
+  placeCursor(pos, msg);
   // clear message box
   fbline(' ', MAX_ROWS - 3);
   fbline(' ', MAX_ROWS - 2);
+  markDrawn(pos);
+  return true;
 }
 
 /*
-  handles backspace event, with message box position as input
+  handles backspace event: removes the character before the cursor and
+  redraws what moved back to fill its place
   (safe)
 */
-void handleBackSpace(struct position *pos)
+void handleBackSpace(struct position *pos, struct gap_buffer *msg, struct undo_log *undo)
 {
-  // if at the start replace char with a space and return
-  if (pos->msg_buff_col_indx == 0 && pos->msg_buff_row_indx == MESSAGE_BOX_START_ROWS)
-  {
-    fbputchar(' ', pos->msg_buff_row_indx, pos->msg_buff_col_indx);
-    return;
-  }
-  // check if i need to go up one line
-  else if (pos->msg_buff_col_indx == 0)
+  size_t at = gapCursor(msg);
+  struct gap_range changed;
+  char gone;
+
+  if (at > 0)
   {
-    fbputchar(' ', pos->msg_buff_row_indx, pos->msg_buff_col_indx);
-    pos->msg_buff_col_indx = MAX_COLS - 1;
-    pos->msg_buff_row_indx--;
-    pos->msg_buff_indx--;
-    pos->cursor_col_indx = MAX_COLS - 1;
-    pos->cursor_row_indx = pos->msg_buff_row_indx;
-    pos->cursor_buff_indx = pos->msg_buff_indx;
-    return;
+    gone = gapCharAt(msg, at - 1);
+    gapDelete(msg, &changed);
+    undoRecord(undo, UNDO_ERASE, at - 1, &gone, 1, NULL, 0);
+    redrawMessageRange(pos, msg, &changed);
   }
-  fbputchar(' ', pos->msg_buff_row_indx, pos->msg_buff_col_indx);
-  pos->msg_buff_indx--; // Might need to remove for Ctrl + Z
-  pos->msg_buff_col_indx--;
-  pos->cursor_col_indx = pos->msg_buff_col_indx;
-  pos->cursor_buff_indx = pos->msg_buff_indx;
+  markDrawn(pos);
 }
 
 /*
   handle cursor blinking at given position
   (safe)
 */
-void handleCursorBlink(struct position *pos, char *buffer)
+void handleCursorBlink(struct position *pos, const struct gap_buffer *msg)
 {
+  size_t i = gapCursor(msg);
+
+  if (pos->deferred)
+    return; /* Down for the burst; endMessageBurst() puts it back */
   if (!pos->blinking)
   {
     fbputchar('_', pos->cursor_row_indx, pos->cursor_col_indx);
     pos->blinking = true;
+    markDrawn(pos);
     return;
   }
-  else if (pos->msg_buff_indx > pos->cursor_buff_indx)
-  {
-    // when cursor reaches end of message buffer show last char
-    printf("Printing char\n");
-    fbputchar(buffer[pos->cursor_buff_indx], pos->cursor_row_indx, pos->cursor_col_indx);
-  }
-  else if (pos->cursor_buff_indx == MESSAGE_SIZE - 1)
-  {
-    // when cursor reaches end of message buffer show last char
-    fbputchar(buffer[MESSAGE_SIZE - 1], pos->cursor_row_indx, pos->cursor_col_indx);
-  }
-  else
-  {
-    fbputchar(' ', pos->cursor_row_indx, pos->cursor_col_indx);
-  }
-  pos->blinking = false;
+  // show whatever the cursor was covering
+  fbputchar(i < gapLength(msg) ? gapCharAt(msg, i) : ' ', pos->cursor_row_indx,
+            pos->cursor_col_indx);
+  pos->blinking = false; /* Not the keystroke showing: that's when it comes back up */
 }
 
 /*
-  Print message buffer to screen
-*/
-// void printChar(struct position *pos, struct special_keys *s_keys, char *msg_buff, char key)
-// {
-//   /* if we hit the end of the screen go to the next row and reset colun index*/
-//   if (pos->cursor_col_indx == pos->msg_buff_col_indx && pos->cursor_row_indx == pos->cursor_row_indx)
-//   {
-//     msg_buff[pos->msg_buff_indx] = key;
-//     if (pos->msg_buff_col_indx == MAX_COLS - 1 && pos->msg_buff_row_indx == MESSAGE_BOX_END_ROWS)
-//     {
-//       fbputchar(key, pos->msg_buff_row_indx, pos->msg_buff_col_indx);
-//     }
-//     else if (pos->msg_buff_col_indx == MAX_COLS - 1)
-//     {
-//       fbputchar(key, pos->msg_buff_row_indx, pos->msg_buff_col_indx);
-//       pos->msg_buff_col_indx = MESSAGE_BOX_START_COLS;
-//       pos->msg_buff_row_indx++;
-//       pos->msg_buff_indx++;
-//       pos->cursor_col_indx = MESSAGE_BOX_START_COLS;
-//       pos->cursor_row_indx++;
-//       pos->cursor_buff_indx++;
-//     }
-//     else
-//     {
-//       fbputchar(key, pos->msg_buff_row_indx, pos->msg_buff_col_indx);
-//       pos->msg_buff_indx++;
-//       pos->msg_buff_col_indx++;
-//       pos->cursor_col_indx++;
-//       pos->cursor_buff_indx++;
-//     }
-//   }
-//   else if (s_keys->insert && (pos->cursor_buff_indx < MESSAGE_SIZE - 1))
-//   {
-//     printf("Insert Unimplemented\n");
-
-
-//     // Too hard lmao
-//     /*
-//     unsigned char *afterCursor = framebuffer + \
-//                         (TEXT_BOX_START_ROWS * FONT_HEIGHT * 2 + fb_vinfo.yoffset) * fb_finfo.line_length + \
-//                         (TEXT_BOX_START_COLS * FONT_WIDTH * 2 + fb_vinfo.xoffset) * BITS_PER_PIXEL / 8;
-//     unsigned char *newAfterCursor = framebuffer + \
-//                         ((TEXT_BOX_START_ROWS + 1) * FONT_HEIGHT * 2 + fb_vinfo.yoffset) * fb_finfo.line_length + \
-//                         (TEXT_BOX_START_COLS * FONT_WIDTH * 2 + fb_vinfo.xoffset) * BITS_PER_PIXEL / 8;
-
-//     // Might break with different ROWS, COLS settings. Esp if MESSAGE_BOX_START_COLS > TEXT_BOX_START_BOLS
-//     ssize_t textBoxSize = ((pos->msg_buff_row_indx - (TEXT_BOX_START_ROWS + 1)) * \
-//                           FONT_HEIGHT * 2 + fb_vinfo.yoffset) * fb_finfo.line_length + \
-//                           ((pos->msg_buff_col_indx - TEXT_BOX_START_COLS) * FONT_WIDTH * 2 + fb_vinfo.xoffset) * BITS_PER_PIXEL / 8;
-
-//     memmove(textBox, newTextBox, textBoxSize);
+ * Start a burst: several reports are queued and will be applied one
+ * after another, so instead of drawing each edit, remember what changed
+ * and draw it once at endMessageBurst().  The cursor is taken down for
+ * the duration.
+ */
+void beginMessageBurst(struct position *pos, const struct gap_buffer *msg)
+{
+  if (pos->blinking)
+    handleCursorBlink(pos, msg);
+  pos->deferred = true;
+  pos->dirty.from = SIZE_MAX;
+  pos->dirty.to = 0;
+}
 
-//     framebuffer +
-//                               (row * FONT_HEIGHT * 2 + fb_vinfo.yoffset) * fb_finfo.line_length +
-//                               (col * FONT_WIDTH * 2 + fb_vinfo.xoffset) * BITS_PER_PIXEL / 8;
-//     */
-//   }
-//   else
-//   {
-//     printf("Yolo replace\n");
-//     msg_buff[pos->cursor_buff_indx] = key;
-//     fbputchar(key, pos->cursor_row_indx, pos->cursor_col_indx);
-//   }
-// }
+/*
+ * End a burst: one repaint of the characters it changed (all the box if
+ * the cursor left the rows it showed), then the cursor goes back up.
+ */
+void endMessageBurst(struct position *pos, const struct gap_buffer *msg)
+{
+  pos->deferred = false;
+  if (!placeCursor(pos, msg))
+    drawRange(pos, msg, pos->dirty.from, pos->dirty.to);
+  handleCursorBlink(pos, msg);
+}
 
-void printChar(struct position *pos, struct special_keys *s_keys, char *msg_buff, char key)
+/*
+  Type key at the cursor: inserted in insert mode, otherwise over the
+  character under the cursor.  Only the cells that changed and are in
+  view are redrawn, so typing mid-message costs the same as at the end.
+*/
+void printChar(struct position *pos, struct special_keys *s_keys, struct gap_buffer *msg,
+               struct undo_log *undo, char key)
 {
-  /* if we hit the end of the screen go to the next row and reset colun index*/
-  if (pos->cursor_col_indx == pos->msg_buff_col_indx && pos->cursor_row_indx == pos->cursor_row_indx)
+  size_t at = gapCursor(msg);
+  struct gap_range changed;
+  char over;
+
+  if (s_keys->insert || at == gapLength(msg))
   {
-    msg_buff[pos->msg_buff_indx] = key;
-    if (pos->msg_buff_col_indx == MAX_COLS - 1 && pos->msg_buff_row_indx == MESSAGE_BOX_END_ROWS)
-    {
-      fbputchar(key, pos->msg_buff_row_indx, pos->msg_buff_col_indx);
-    }
-    else if (pos->msg_buff_col_indx == MAX_COLS - 1)
-    {
-      fbputchar(key, pos->msg_buff_row_indx, pos->msg_buff_col_indx);
-      pos->msg_buff_col_indx = MESSAGE_BOX_START_COLS;
-      pos->msg_buff_row_indx++;
-      pos->msg_buff_indx++;
-      pos->cursor_col_indx = MESSAGE_BOX_START_COLS;
-      pos->cursor_row_indx++;
-      pos->cursor_buff_indx++;
-    }
-    else
+    if (gapInsert(msg, key, &changed))
     {
-      fbputchar(key, pos->msg_buff_row_indx, pos->msg_buff_col_indx);
-      pos->msg_buff_indx++;
-      pos->msg_buff_col_indx++;
-      pos->cursor_col_indx++;
-      pos->cursor_buff_indx++;
-    }
-  }
-  else if (s_keys->insert && (pos->cursor_buff_indx < MESSAGE_SIZE - 1))
-  {
-    printf("Insert Activated %d\n", pos->cursor_buff_indx);
-    int i = pos->cursor_buff_indx;
-    // memmove(msg_buff[i + 1], msg_buff[i], (pos->cursor_buff_indx - i - 1));
-    char temp = msg_buff[i];
-    for (i = MESSAGE_SIZE - 1; i > pos->cursor_buff_indx; i--){
-      msg_buff[i] = msg_buff[i-1];
-    }
-    msg_buff[pos->cursor_buff_indx] = key;
-    pos->msg_buff_col_indx++;
-    if (pos->msg_buff_col_indx == MAX_COLS){
-      pos->msg_buff_col_indx = 0;
-      pos->msg_buff_row_indx++;
+      undoRecord(undo, UNDO_TYPE, at, NULL, 0, &key, 1);
+      redrawMessageRange(pos, msg, &changed);
     }
-    pos->cursor_col_indx++;
-    if (pos->cursor_col_indx == MAX_COLS){
-      pos->cursor_col_indx = 0;
-      pos->cursor_row_indx++;
-    }
-    pos->cursor_buff_indx++;
-    pos->msg_buff_indx++;
-    for (int i = pos->cursor_buff_indx - 1; i < pos->msg_buff_indx && i < MESSAGE_SIZE-1; i++){
-      fbputchar(msg_buff[i], MESSAGE_BOX_START_ROWS + i / 64, i % 64);
-    }
-
-    // Too hard lmao
-    
-    /*
-    framebuffer +
-                                (row * FONT_HEIGHT * 2 + fb_vinfo.yoffset) * fb_finfo.line_length +
-                                (col * FONT_WIDTH * 2 + fb_vinfo.xoffset) * BITS_PER_PIXEL / 8;
-
-    unsigned char *afterCursor = framebuffer + \
-                        (TEXT_BOX_START_ROWS * FONT_HEIGHT * 2 + fb_vinfo.yoffset) * fb_finfo.line_length + \
-                        (TEXT_BOX_START_COLS * FONT_WIDTH * 2 + fb_vinfo.xoffset) * BITS_PER_PIXEL / 8;
-    unsigned char *newAfterCursor = framebuffer + \
-                        ((TEXT_BOX_START_ROWS) * FONT_HEIGHT * 2 + fb_vinfo.yoffset) * fb_finfo.line_length + \
-                        (TEXT_BOX_START_COLS * FONT_WIDTH * 2 + fb_vinfo.xoffset) * BITS_PER_PIXEL / 8;
-
-    // Might break with different ROWS, COLS settings. Esp if MESSAGE_BOX_START_COLS > TEXT_BOX_START_BOLS
-    ssize_t textBoxSize = ((pos->msg_buff_row_indx - (TEXT_BOX_START_ROWS + 1)) * \
-                          FONT_HEIGHT * 2 + fb_vinfo.yoffset) * fb_finfo.line_length + \
-                          ((pos->msg_buff_col_indx - TEXT_BOX_START_COLS) * FONT_WIDTH * 2 + fb_vinfo.xoffset) * BITS_PER_PIXEL / 8;
-
-    memmove(newAfterCursor, afterCursor, textBoxSize);
-
-    framebuffer +
-                              (row * FONT_HEIGHT * 2 + fb_vinfo.yoffset) * fb_finfo.line_length +
-                              (col * FONT_WIDTH * 2 + fb_vinfo.xoffset) * BITS_PER_PIXEL / 8;
-    
-    */
-  //  if (pos->msg_buff_row_indx == pos->cursor_row_indx && pos->msg_buff_col_indx < MAX_COLS - 1) { // Same row no flowing to next line
-  //   unsigned char *Cursor = framebuffer + (pos->cursor_row_indx * FONT_HEIGHT * 2 + fb_vinfo.yoffset) * fb_finfo.line_length +\
-  //                                              ((pos->cursor_col_indx) * FONT_WIDTH * 2 + fb_vinfo.xoffset) * BITS_PER_PIXEL / 8;
-  //   unsigned char *afterCursor = framebuffer + (pos->cursor_row_indx * FONT_HEIGHT * 2 + fb_vinfo.yoffset) * fb_finfo.line_length +\
-  //                                         ((pos->cursor_col_indx + 1) * FONT_WIDTH * 2 + fb_vinfo.xoffset) * BITS_PER_PIXEL / 8;
-  //   ssize_t cursorToEndCols = ((MAX_COLS - (pos->cursor_buff_indx + 1)) * FONT_WIDTH * 2 + fb_vinfo.xoffset) * BITS_PER_PIXEL / 8;
-  //   memmove(afterCursor, Cursor, cursorToEndCols);
-  //   memmove(msg_buff + pos->cursor_buff_indx, msg_buff + pos->cursor_buff_indx + 1, pos->msg_buff_col_indx - pos->cursor_buff_indx);
-  //  }
   }
   else
   {
-    printf("Yolo replace\n");
-    msg_buff[pos->cursor_buff_indx] = key;
-    fbputchar(key, pos->cursor_row_indx, pos->cursor_col_indx);
+    over = gapCharAt(msg, at);
+    gapReplace(msg, key, &changed);
+    undoRecord(undo, UNDO_OVERTYPE, at, &over, 1, &key, 1);
+    redrawMessageRange(pos, msg, &changed);
   }
+  markDrawn(pos);
 }
 
 /*
@@ -1,7 +1,11 @@
 #ifndef _FBPUTCHAR_H
 #define _FBPUTCHAR_H
 #include <stdint.h>
+#include <stddef.h>
 #include <stdbool.h>
+#include "gapbuf.h"
+#include "msghist.h"
+#include "undo.h"
 #define FBOPEN_DEV -1         /* Couldn't open the device */
 #define FBOPEN_FSCREENINFO -2 /* Couldn't read the fixed info */
 #define FBOPEN_VSCREENINFO -3 /* Couldn't read the variable info */
@@ -12,36 +16,21 @@
 #define MESSAGE_BOX_START_ROWS MAX_ROWS - 3
 #define MESSAGE_BOX_START_COLS 0
 #define MESSAGE_BOX_END_ROWS MAX_ROWS - 2
-#define MESSAGE_SIZE 128
+#define MESSAGE_BOX_ROWS ((MESSAGE_BOX_END_ROWS) - (MESSAGE_BOX_START_ROWS) + 1)
 #define TEXT_BOX_START_ROWS 8
 #define TEXT_BOX_START_COLS 0
 #define TEXT_BOX_END_ROWS MESSAGE_BOX_START_ROWS - 1
 #define TAB_SPACING 4
-#define RESET_SPECIAL_KEYS(X) \
-  {                           \
-    X.shift_pressed = false;  \
-    X.escape_pressed = false; \
-    RESET_BACKSPACE(X);       \
-    RESET_ARROW_KEYS(X)       \
-  }
-#define RESET_ARROW_KEYS(X) \
-  {                         \
-    X.down_arrow = false;   \
-    X.up_arrow = false;     \
-    X.right_arrow = false;  \
-    X.left_arrow = false;   \
-  }
-#define RESET_BACKSPACE(X) X.backspace_pressed = false
 
 struct position
 {
-  uint8_t msg_buff_col_indx;
-  uint8_t msg_buff_row_indx;
   uint8_t cursor_col_indx;
   uint8_t cursor_row_indx;
-  uint8_t msg_buff_indx;
-  uint8_t cursor_buff_indx;
+  size_t msg_top_row; /* First row of the message shown in the message box */
   bool blinking;
+  uint64_t input_stamp; /* Arrival time of a keystroke not yet drawn, or 0 */
+  bool deferred;           /* In a burst: edits only grow dirty until endMessageBurst() */
+  struct gap_range dirty;  /* Message characters the burst changed */
 };
 
 struct special_keys
@@ -51,7 +40,6 @@ struct special_keys
   bool up_arrow;
   bool right_arrow;
   bool down_arrow;
-  bool shift_pressed;
   bool backspace_pressed;
   bool escape_pressed;
   bool insert;
@@ -59,6 +47,22 @@ struct special_keys
 
 extern int fbopen(void);
 extern void fbputchar(char, int, int);
+extern void fbputcharInverse(char c, int row, int col);
 extern void fbputs(const char *, int, int);
-struct special_keys s_keys;
+extern void fbline(char c, int row);
+extern void clearScreen(void);
+extern void fbScrollRows(int top, int bottom, int n);
+extern void handleArrowKeys(struct position *pos, struct gap_buffer *msg, struct special_keys *s_keys);
+extern bool handleEnterKey(struct position *pos, struct gap_buffer *msg, struct msghist *hist);
+extern void handleBackSpace(struct position *pos, struct gap_buffer *msg, struct undo_log *undo);
+extern void handleCursorBlink(struct position *pos, const struct gap_buffer *msg);
+extern void redrawMessage(struct position *pos, const struct gap_buffer *msg);
+extern void redrawMessageRange(struct position *pos, const struct gap_buffer *msg,
+                               const struct gap_range *changed);
+extern void beginMessageBurst(struct position *pos, const struct gap_buffer *msg);
+extern void endMessageBurst(struct position *pos, const struct gap_buffer *msg);
+extern void printChar(struct position *pos, struct special_keys *s_keys, struct gap_buffer *msg,
+                      struct undo_log *undo, char key);
+extern struct special_keys s_keys; /* Owned by the main loop thread */
+extern bool sendMsg(void);         /* Queues the message box, in lab2.c */
 #endif
@@ -0,0 +1,100 @@
+/*
+ * framer: newline framing for data received from the chat server
+ */
+#include "framer.h"
+
+#include <string.h>
+
+void framerInit(struct line_framer *f)
+{
+  f->start = f->scan = f->end = 0;
+}
+
+/*
+  Where the next read() should go and how much it may put there.
+  Always at least RECV_READ_SIZE.
+*/
+char *framerSpace(struct line_framer *f, size_t *space)
+{
+  if (RECV_BUFFER_SIZE - f->end < RECV_READ_SIZE)
+  {
+    size_t partial = f->end - f->start;
+    memmove(f->buf, f->buf + f->start, partial);
+    f->scan -= f->start;
+    f->start = 0;
+    f->end = partial;
+  }
+  *space = RECV_BUFFER_SIZE - f->end;
+  return f->buf + f->end;
+}
+
+/*
+  Emit every complete line from scan on, asking yield (if any) after
+  each whether to stop there.  Stopping leaves scan at the next line.
+*/
+static void emitLines(struct line_framer *f, line_f emit, yield_f yield)
+{
+  char *nl;
+  size_t len;
+
+  while ((nl = memchr(f->buf + f->scan, '\n', f->end - f->scan)) != NULL)
+  {
+    len = nl - (f->buf + f->start);
+    if (len > 0 && f->buf[f->start + len - 1] == '\r')
+      len--;
+    emit(f->buf + f->start, len);
+    f->start = f->scan = nl - f->buf + 1;
+    if (yield != NULL && f->scan < f->end && yield())
+      return;
+  }
+  f->scan = f->end;
+
+  /* A line with no end in sight: break it rather than stall */
+  if (f->end - f->start >= RECV_MAX_LINE)
+  {
+    emit(f->buf + f->start, f->end - f->start);
+    f->start = f->scan = f->end;
+  }
+  if (f->start == f->end)
+    f->start = f->scan = f->end = 0;
+}
+
+/*
+  n bytes were read into the space from framerSpace(): emit the lines
+  they complete.  memchr does the newline search a word (or vector) at
+  a time.
+*/
+void framerCommit(struct line_framer *f, size_t n, line_f emit, yield_f yield)
+{
+  f->end += n;
+  emitLines(f, emit, yield);
+}
+
+/*
+  Whether data is left that yield stopped short of.
+*/
+bool framerBacklog(const struct line_framer *f)
+{
+  return f->scan < f->end;
+}
+
+/*
+  Carry on emitting where yield stopped it.
+*/
+void framerResume(struct line_framer *f, line_f emit, yield_f yield)
+{
+  if (framerBacklog(f))
+    emitLines(f, emit, yield);
+}
+
+/*
+  The stream ended: hand out the backlog and whatever partial line is
+  left.
+*/
+void framerFinish(struct line_framer *f, line_f emit)
+{
+  emitLines(f, emit, NULL);
+  if (f->end > f->start)
+    emit(f->buf + f->start, f->end - f->start);
+  framerInit(f);
+}
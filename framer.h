@@ -0,0 +1,43 @@
+#ifndef _FRAMER_H
+#define _FRAMER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#define RECV_READ_SIZE (64 * 1024)  /* Bytes asked for per read() */
+#define RECV_MAX_LINE (64 * 1024)   /* Longer lines are broken here */
+#define RECV_BUFFER_SIZE (RECV_READ_SIZE + RECV_MAX_LINE)
+
+/* Called with each complete line, without its newline.  The view is
+   only valid until the next read into the framer. */
+typedef void (*line_f)(const char *line, size_t len);
+
+/* Asked between lines whether to stop and let something more urgent run */
+typedef bool (*yield_f)(void);
+
+/*
+ * Splits the byte stream from the server into lines.  Data is read
+ * straight into buf; complete lines are handed out as views into it and
+ * only the trailing partial line is kept.  When the space after it runs
+ * short the partial line is moved back to the front, so buf behaves as
+ * a ring whose lines never wrap.
+ *
+ * Handing out lines can stop early when a yield hook says so; the rest
+ * stay in buf as a backlog, and nothing more may be read in until
+ * framerResume() has cleared it.
+ */
+struct line_framer
+{
+  char buf[RECV_BUFFER_SIZE];
+  size_t start; /* First byte of the partial line */
+  size_t scan;  /* Where the newline search resumes */
+  size_t end;   /* End of received data */
+};
+
+extern void framerInit(struct line_framer *f);
+extern char *framerSpace(struct line_framer *f, size_t *space);
+extern void framerCommit(struct line_framer *f, size_t n, line_f emit, yield_f yield);
+extern bool framerBacklog(const struct line_framer *f);
+extern void framerResume(struct line_framer *f, line_f emit, yield_f yield);
+extern void framerFinish(struct line_framer *f, line_f emit);
+#endif
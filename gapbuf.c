@@ -0,0 +1,196 @@
+/*
+ * gapbuf: gap buffer holding the message being typed
+ */
+#include "gapbuf.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+void gapInit(struct gap_buffer *g)
+{
+  memset(g, 0, sizeof(*g));
+}
+
+/*
+ * Release the text and leave an empty buffer, ready for the next message.
+ */
+void gapFree(struct gap_buffer *g)
+{
+  free(g->buf);
+  gapInit(g);
+}
+
+size_t gapLength(const struct gap_buffer *g)
+{
+  return g->gap_start + (g->size - g->gap_end);
+}
+
+/*
+  The gap has closed: double buf and move the text after it to the new end.
+*/
+static bool grow(struct gap_buffer *g)
+{
+  size_t size = g->size ? g->size * 2 : GAP_MIN_SIZE;
+  size_t after = g->size - g->gap_end;
+  char *buf = realloc(g->buf, size);
+
+  if (buf == NULL)
+    return false;
+  memmove(buf + size - after, buf + g->gap_end, after);
+  g->buf = buf;
+  g->gap_end = size - after;
+  g->size = size;
+  return true;
+}
+
+size_t gapCursor(const struct gap_buffer *g)
+{
+  return g->gap_start;
+}
+
+/*
+ * Character i of the message, counting as if there were no gap.
+ */
+char gapCharAt(const struct gap_buffer *g, size_t i)
+{
+  if (i < g->gap_start)
+    return g->buf[i];
+  return g->buf[i - g->gap_start + g->gap_end];
+}
+
+/*
+ * Put the cursor before character i (clamped to the end of the message).
+ */
+void gapMoveTo(struct gap_buffer *g, size_t i)
+{
+  size_t len = gapLength(g);
+  size_t n;
+
+  if (i > len)
+    i = len;
+  if (i < g->gap_start)
+  {
+    /* Characters between i and the cursor go to the back */
+    n = g->gap_start - i;
+    memmove(g->buf + g->gap_end - n, g->buf + i, n);
+    g->gap_start -= n;
+    g->gap_end -= n;
+  }
+  else if (i > g->gap_start)
+  {
+    n = i - g->gap_start;
+    memmove(g->buf + g->gap_start, g->buf + g->gap_end, n);
+    g->gap_start += n;
+    g->gap_end += n;
+  }
+}
+
+/*
+ * Type c at the cursor, pushing the rest of the message along.  Returns
+ * false (and changes nothing) if there was no memory for it.
+ */
+bool gapInsert(struct gap_buffer *g, char c, struct gap_range *changed)
+{
+  if (g->gap_start == g->gap_end && !grow(g))
+    return false;
+  changed->from = g->gap_start;
+  g->buf[g->gap_start++] = c;
+  changed->to = gapLength(g);
+  return true;
+}
+
+/*
+ * Type c over the character after the cursor, or insert it at the end.
+ */
+bool gapReplace(struct gap_buffer *g, char c, struct gap_range *changed)
+{
+  if (g->gap_end == g->size)
+    return gapInsert(g, c, changed);
+  changed->from = g->gap_start;
+  changed->to = g->gap_start + 1;
+  g->gap_end++;
+  g->buf[g->gap_start++] = c;
+  return true;
+}
+
+/*
+ * Remove the character before the cursor.  The rest of the message moves
+ * back, so the range runs to the old end, whose cell is now blank.
+ */
+bool gapDelete(struct gap_buffer *g, struct gap_range *changed)
+{
+  if (g->gap_start == 0)
+    return false;
+  changed->to = gapLength(g);
+  changed->from = --g->gap_start;
+  return true;
+}
+
+/*
+ * Replace the remove characters at pos with text, leaving the cursor
+ * after it.  Costs the length of text plus however far the cursor has
+ * to move.  Returns false (and changes nothing) if there was no memory
+ * for it.
+ */
+bool gapSplice(struct gap_buffer *g, size_t pos, size_t remove, const char *text,
+               size_t len, struct gap_range *changed)
+{
+  size_t old_len = gapLength(g), new_len;
+
+  if (pos > old_len)
+    pos = old_len;
+  if (remove > old_len - pos)
+    remove = old_len - pos;
+  while (g->gap_end - g->gap_start + remove < len)
+    if (!grow(g))
+      return false;
+  gapMoveTo(g, pos);
+  g->gap_end += remove;
+  memcpy(g->buf + g->gap_start, text, len);
+  g->gap_start += len;
+  new_len = gapLength(g);
+  changed->from = pos;
+  if (remove == len)
+    changed->to = pos + len;
+  else
+    changed->to = old_len > new_len ? old_len : new_len;
+  return true;
+}
+
+/*
+ * Replace the message with text, cursor at its end.  The text is copied
+ * once, into a buffer only replaced if it's too small.  Returns false
+ * (and changes nothing) if there was no memory for it.
+ */
+bool gapLoad(struct gap_buffer *g, const char *text, size_t len)
+{
+  if (len > g->size)
+  {
+    size_t size = g->size ? g->size : GAP_MIN_SIZE;
+    char *buf;
+
+    while (size < len)
+      size *= 2;
+    if ((buf = malloc(size)) == NULL)
+      return false;
+    free(g->buf);
+    g->buf = buf;
+    g->size = size;
+  }
+  memcpy(g->buf, text, len);
+  g->gap_start = len;
+  g->gap_end = g->size;
+  return true;
+}
+
+/*
+ * The whole message as one run of characters, for sending.  Closes the
+ * gap by moving it to the end, which copies nothing when the cursor is
+ * already there.  Valid until the next edit.
+ */
+const char *gapText(struct gap_buffer *g, size_t *len)
+{
+  *len = gapLength(g);
+  gapMoveTo(g, *len);
+  return g->buf;
+}
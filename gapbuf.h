@@ -0,0 +1,48 @@
+#ifndef _GAPBUF_H
+#define _GAPBUF_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#define GAP_MIN_SIZE 64 /* First allocation; it doubles from there */
+
+/* Characters [from, to) whose on-screen cell has to be redrawn */
+struct gap_range
+{
+  size_t from, to;
+};
+
+/*
+ * The message being typed, kept as the text before the cursor at the
+ * front of buf and the text after it at the back, with the free space
+ * (the gap) between them.  Typing or deleting at the cursor only moves
+ * an edge of the gap, so it costs the same in the middle of a message
+ * as at its end; moving the cursor moves the gap along with it, copying
+ * only the characters it steps over.
+ *
+ * There is no limit on the length.  Nothing is allocated until the first
+ * character is typed, and when the gap closes up buf doubles, so memory
+ * only grows as the message does.
+ */
+struct gap_buffer
+{
+  char *buf;
+  size_t size;
+  size_t gap_start; /* Also the cursor: characters before it */
+  size_t gap_end;   /* First character after the cursor */
+};
+
+extern void gapInit(struct gap_buffer *g);
+extern void gapFree(struct gap_buffer *g);
+extern size_t gapLength(const struct gap_buffer *g);
+extern size_t gapCursor(const struct gap_buffer *g);
+extern char gapCharAt(const struct gap_buffer *g, size_t i);
+extern void gapMoveTo(struct gap_buffer *g, size_t i);
+extern bool gapInsert(struct gap_buffer *g, char c, struct gap_range *changed);
+extern bool gapReplace(struct gap_buffer *g, char c, struct gap_range *changed);
+extern bool gapDelete(struct gap_buffer *g, struct gap_range *changed);
+extern bool gapSplice(struct gap_buffer *g, size_t pos, size_t remove, const char *text,
+                      size_t len, struct gap_range *changed);
+extern bool gapLoad(struct gap_buffer *g, const char *text, size_t len);
+extern const char *gapText(struct gap_buffer *g, size_t *len);
+#endif
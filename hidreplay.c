@@ -0,0 +1,113 @@
+/*
+ * hidreplay: record raw keyboard reports to a file and feed them back
+ * in place of the USB device, so input load can be reproduced without
+ * a keyboard attached.
+ */
+#include "hidreplay.h"
+#include "metrics.h"
+
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+/*
+ * Create a recording file and write its header.  An existing file is
+ * truncated, not appended to: replay paces every record from the first
+ * one's timestamp, so a second run's records behind it would replay
+ * after the gap between the runs (or at once, after a reboot).  Returns
+ * NULL if the file couldn't be created.
+ */
+FILE *hidRecordOpen(const char *path)
+{
+  FILE *fp = fopen(path, "wb");
+  if (fp == NULL)
+    return NULL;
+  if (fwrite(HIDREC_MAGIC, 1, HIDREC_MAGIC_LEN, fp) != HIDREC_MAGIC_LEN)
+  {
+    fclose(fp);
+    return NULL;
+  }
+  return fp;
+}
+
+/*
+  Append one report.  Records go through stdio buffering so the
+  keyboard thread doesn't pay a syscall per keystroke.
+*/
+void hidRecordPacket(FILE *fp, const struct usb_keyboard_packet *packet, uint64_t timestamp_ns)
+{
+  struct hid_record rec;
+  rec.timestamp_ns = timestamp_ns;
+  rec.packet = *packet;
+  fwrite(&rec, sizeof(rec), 1, fp);
+}
+
+void hidRecordClose(FILE *fp)
+{
+  if (fp != NULL)
+    fclose(fp);
+}
+
+/*
+ * Open a recording for replay.  Returns 0 on success, -1 if the file
+ * is missing or isn't a recording.
+ */
+int hidReplayOpen(struct hid_replay *replay, const char *path, double speed)
+{
+  char magic[HIDREC_MAGIC_LEN];
+
+  memset(replay, 0, sizeof(*replay));
+  if ((replay->fp = fopen(path, "rb")) == NULL)
+    return -1;
+  if (fread(magic, 1, HIDREC_MAGIC_LEN, replay->fp) != HIDREC_MAGIC_LEN ||
+      memcmp(magic, HIDREC_MAGIC, HIDREC_MAGIC_LEN) != 0)
+  {
+    fclose(replay->fp);
+    replay->fp = NULL;
+    return -1;
+  }
+  replay->speed = speed < 0 ? REPLAY_FULL_SPEED : speed;
+  return 0;
+}
+
+/*
+  Fetch the next report, sleeping until it is due relative to the first
+  one (scaled by speed).  Returns 1 with the packet filled in, or 0 at
+  the end of the recording.
+*/
+int hidReplayNext(struct hid_replay *replay, struct usb_keyboard_packet *packet)
+{
+  struct hid_record rec;
+
+  if (fread(&rec, sizeof(rec), 1, replay->fp) != 1)
+    return 0;
+
+  if (!replay->started)
+  {
+    replay->first_ns = rec.timestamp_ns;
+    replay->start_ns = monotonicNs();
+    replay->started = true;
+  }
+  else if (replay->speed > 0 && rec.timestamp_ns > replay->first_ns)
+  {
+    uint64_t due = replay->start_ns +
+                   (uint64_t)((rec.timestamp_ns - replay->first_ns) / replay->speed);
+    struct timespec ts = {
+        .tv_sec = due / 1000000000ULL,
+        .tv_nsec = due % 1000000000ULL,
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+      ;
+  }
+
+  *packet = rec.packet;
+  replay->replayed++;
+  return 1;
+}
+
+void hidReplayClose(struct hid_replay *replay)
+{
+  if (replay->fp != NULL)
+    fclose(replay->fp);
+  replay->fp = NULL;
+}
@@ -0,0 +1,40 @@
+#ifndef _HIDREPLAY_H
+#define _HIDREPLAY_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "usbkeyboard.h"
+
+/*
+ * Recording file format: an 8 byte magic followed by fixed size records,
+ * each one a CLOCK_MONOTONIC arrival time in nanoseconds and the raw
+ * 8 byte HID report (host byte order, 16 bytes per record).
+ */
+#define HIDREC_MAGIC "HIDREC1\n"
+#define HIDREC_MAGIC_LEN 8
+#define REPLAY_FULL_SPEED 0.0 /* Don't sleep between reports */
+
+struct hid_record
+{
+  uint64_t timestamp_ns;
+  struct usb_keyboard_packet packet;
+};
+
+struct hid_replay
+{
+  FILE *fp;
+  double speed;         /* 1.0 = recorded speed, N = N times faster, 0 = no delay */
+  uint64_t first_ns;    /* Timestamp of the first record in the file */
+  uint64_t start_ns;    /* When we started replaying it */
+  bool started;
+  unsigned long replayed;
+};
+
+extern FILE *hidRecordOpen(const char *path);
+extern void hidRecordPacket(FILE *fp, const struct usb_keyboard_packet *packet, uint64_t timestamp_ns);
+extern void hidRecordClose(FILE *fp);
+extern int hidReplayOpen(struct hid_replay *replay, const char *path, double speed);
+extern int hidReplayNext(struct hid_replay *replay, struct usb_keyboard_packet *packet);
+extern void hidReplayClose(struct hid_replay *replay);
+#endif
@@ -0,0 +1,50 @@
+/*
+ * inputqueue: hands keyboard reports to the thread that owns the editor
+ */
+#include "inputqueue.h"
+#include "metrics.h"
+
+#include <sched.h>
+
+/*
+  Producer side.  Only waits if the main loop is a whole queue behind,
+  and that wait is what the editor handoff metric counts.
+*/
+void inputQueuePush(struct input_queue *q, const struct key_report *report)
+{
+  unsigned tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+
+  if (tail - atomic_load_explicit(&q->head, memory_order_acquire) == INPUT_QUEUE_SIZE)
+  {
+    uint64_t start = monotonicNs();
+    while (tail - atomic_load_explicit(&q->head, memory_order_acquire) == INPUT_QUEUE_SIZE)
+      sched_yield();
+    editor_waits++;
+    editor_wait_ns += monotonicNs() - start;
+  }
+  q->slots[tail % INPUT_QUEUE_SIZE] = *report;
+  atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+}
+
+/*
+  Consumer side.  Returns false when there is nothing queued.
+*/
+bool inputQueuePop(struct input_queue *q, struct key_report *report)
+{
+  unsigned head = atomic_load_explicit(&q->head, memory_order_relaxed);
+
+  if (head == atomic_load_explicit(&q->tail, memory_order_acquire))
+    return false;
+  *report = q->slots[head % INPUT_QUEUE_SIZE];
+  atomic_store_explicit(&q->head, head + 1, memory_order_release);
+  return true;
+}
+
+/*
+  Consumer side: nothing is waiting right now.
+*/
+bool inputQueueEmpty(struct input_queue *q)
+{
+  return atomic_load_explicit(&q->head, memory_order_relaxed) ==
+         atomic_load_explicit(&q->tail, memory_order_acquire);
+}
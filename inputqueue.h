@@ -0,0 +1,32 @@
+#ifndef _INPUTQUEUE_H
+#define _INPUTQUEUE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "usbkeyboard.h"
+
+#define INPUT_QUEUE_SIZE 256 /* Must be a power of two */
+
+/* One keyboard report on its way from the keyboard thread to the editor */
+struct key_report
+{
+  uint64_t arrived_ns;
+  struct usb_keyboard_packet packet;
+};
+
+/*
+ * Single producer (keyboard thread), single consumer (main loop) ring.
+ * No lock: each side only writes its own index.
+ */
+struct input_queue
+{
+  struct key_report slots[INPUT_QUEUE_SIZE];
+  atomic_uint head; /* Next slot the consumer reads */
+  atomic_uint tail; /* Next slot the producer writes */
+};
+
+extern void inputQueuePush(struct input_queue *q, const struct key_report *report);
+extern bool inputQueuePop(struct input_queue *q, struct key_report *report);
+extern bool inputQueueEmpty(struct input_queue *q);
+#endif
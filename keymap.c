@@ -0,0 +1,232 @@
+/*
+ * keymap: table of what each key does, optionally read from a file
+ */
+#include "keymap.h"
+#include "usbkeyboard.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *action_names[ACT_COUNT] = {
+    [ACT_NONE] = "none",
+    [ACT_TYPE] = "type",
+    [ACT_SEND] = "send",
+    [ACT_BACKSPACE] = "backspace",
+    [ACT_TAB] = "tab",
+    [ACT_LEFT] = "left",
+    [ACT_RIGHT] = "right",
+    [ACT_UP] = "up",
+    [ACT_DOWN] = "down",
+    [ACT_UNDO] = "undo",
+    [ACT_REDO] = "redo",
+    [ACT_INSERT] = "insert",
+    [ACT_CAPS_LOCK] = "capslock",
+    [ACT_PAGE_UP] = "pageup",
+    [ACT_PAGE_DOWN] = "pagedown",
+    [ACT_QUIT] = "quit",
+    [ACT_SEARCH] = "search",
+    [ACT_FIND_OLDER] = "findolder",
+    [ACT_FIND_NEWER] = "findnewer",
+};
+
+/* Keys without a character, by name; they also do the same whatever the modifiers */
+static const struct
+{
+  const char *name;
+  uint8_t keycode;
+  uint8_t action;
+} named_keys[] = {
+    {"enter", 0x28, ACT_NONE},
+    {"esc", 0x29, ACT_QUIT},
+    {"backspace", 0x2a, ACT_BACKSPACE},
+    {"tab", 0x2b, ACT_NONE},
+    {"space", 0x2c, ACT_NONE},
+    {"capslock", 0x39, ACT_CAPS_LOCK},
+    {"f1", 0x3a, ACT_NONE},
+    {"f2", 0x3b, ACT_NONE},
+    {"f3", 0x3c, ACT_NONE},
+    {"f4", 0x3d, ACT_NONE},
+    {"f5", 0x3e, ACT_NONE},
+    {"f6", 0x3f, ACT_NONE},
+    {"f7", 0x40, ACT_NONE},
+    {"f8", 0x41, ACT_NONE},
+    {"f9", 0x42, ACT_NONE},
+    {"f10", 0x43, ACT_NONE},
+    {"f11", 0x44, ACT_NONE},
+    {"f12", 0x45, ACT_NONE},
+    {"insert", 0x49, ACT_INSERT},
+    {"home", 0x4a, ACT_NONE},
+    {"pageup", 0x4b, ACT_PAGE_UP},
+    {"delete", 0x4c, ACT_NONE},
+    {"end", 0x4d, ACT_NONE},
+    {"pagedown", 0x4e, ACT_PAGE_DOWN},
+    {"right", 0x4f, ACT_RIGHT},
+    {"left", 0x50, ACT_LEFT},
+    {"down", 0x51, ACT_DOWN},
+    {"up", 0x52, ACT_UP},
+};
+#define NAMED_KEYS (sizeof(named_keys) / sizeof(named_keys[0]))
+
+/*
+  What a key does by default: the character getCharFromKeyCode() gives
+  it, or its fixed action.
+*/
+static struct key_binding defaultBinding(unsigned mods, uint8_t keycode)
+{
+  struct key_binding b = {ACT_NONE, 0};
+  uint8_t modifiers = (mods & KEYMAP_SHIFT ? USB_LSHIFT : 0) |
+                      (mods & KEYMAP_CTRL ? USB_LCTRL : 0) |
+                      (mods & KEYMAP_ALT ? USB_LALT : 0);
+  char ch;
+
+  for (size_t i = 0; i < NAMED_KEYS; i++)
+  {
+    if (named_keys[i].keycode == keycode && named_keys[i].action != ACT_NONE)
+    {
+      b.action = named_keys[i].action;
+      return b;
+    }
+  }
+  ch = getCharFromKeyCode(modifiers, keycode);
+  if (ch == '\n')
+    b.action = ACT_SEND;
+  else if (ch == '\t')
+    b.action = ACT_TAB;
+  else if (ch == CTRL_KEY('z'))
+    b.action = ACT_UNDO;
+  else if (ch == CTRL_KEY('y'))
+    b.action = ACT_REDO;
+  else if (ch == CTRL_KEY('f'))
+    b.action = ACT_SEARCH;
+  else if (ch == CTRL_KEY('r'))
+    b.action = ACT_FIND_OLDER;
+  else if (ch == CTRL_KEY('s'))
+    b.action = ACT_FIND_NEWER;
+  else if (ch >= ' ')
+  {
+    b.action = ACT_TYPE;
+    b.ch = ch;
+  }
+  return b;
+}
+
+/*
+ * The built-in bindings.  Builds the table from getCharFromKeyCode(), so
+ * call it before caps lock can be on.
+ */
+void keymapInit(struct keymap *km)
+{
+  for (unsigned mods = 0; mods < KEYMAP_MODS; mods++)
+    for (unsigned keycode = 0; keycode < 256; keycode++)
+      km->keys[mods][keycode] = defaultBinding(mods, keycode);
+}
+
+/*
+  Keycode for a key name: a named key, a letter, a digit or 0xNN.
+  Returns -1 if there's no such key.
+*/
+static int parseKey(const char *name)
+{
+  char *end;
+  long code;
+
+  for (size_t i = 0; i < NAMED_KEYS; i++)
+    if (strcmp(name, named_keys[i].name) == 0)
+      return named_keys[i].keycode;
+  if (name[0] >= 'a' && name[0] <= 'z' && name[1] == '\0')
+    return 0x04 + (name[0] - 'a');
+  if (name[0] >= '1' && name[0] <= '9' && name[1] == '\0')
+    return 0x1e + (name[0] - '1');
+  if (name[0] == '0' && name[1] == '\0')
+    return 0x27;
+  if (strncmp(name, "0x", 2) == 0)
+  {
+    code = strtol(name + 2, &end, 16);
+    if (*end == '\0' && end != name + 2 && code >= 0 && code < 256)
+      return code;
+  }
+  return -1;
+}
+
+/*
+  Split "ctrl+shift+k" into its modifier bits and keycode.  Returns -1
+  if any part isn't recognised.
+*/
+static int parseCombo(char *combo, unsigned *mods)
+{
+  char *plus;
+
+  *mods = 0;
+  while ((plus = strchr(combo, '+')) != NULL && plus[1] != '\0')
+  {
+    *plus = '\0';
+    if (strcmp(combo, "shift") == 0)
+      *mods |= KEYMAP_SHIFT;
+    else if (strcmp(combo, "ctrl") == 0)
+      *mods |= KEYMAP_CTRL;
+    else if (strcmp(combo, "alt") == 0)
+      *mods |= KEYMAP_ALT;
+    else
+      return -1;
+    combo = plus + 1;
+  }
+  return parseKey(combo);
+}
+
+/*
+ * Apply the bindings in the file at path on top of what km has.
+ * Returns 0 on success, -1 if the file couldn't be read, or the number
+ * of the first line that couldn't be understood (nothing after it is
+ * applied).
+ */
+int keymapLoad(struct keymap *km, const char *path)
+{
+  char line[128], combo[64], action[16], arg[8];
+  struct key_binding b;
+  unsigned mods;
+  int lineno = 0, bad = 0, keycode, n;
+  FILE *fp;
+
+  if ((fp = fopen(path, "r")) == NULL)
+    return -1;
+  while (fgets(line, sizeof(line), fp) != NULL)
+  {
+    lineno++;
+    n = sscanf(line, "%63s %15s %7s", combo, action, arg);
+    if (n <= 0 || combo[0] == '#')
+      continue;
+    if (n < 2 || (keycode = parseCombo(combo, &mods)) < 0)
+    {
+      bad = lineno;
+      break;
+    }
+    for (b.action = 0; b.action < ACT_COUNT; b.action++)
+      if (strcmp(action, action_names[b.action]) == 0)
+        break;
+    if (b.action == ACT_COUNT || (b.action == ACT_TYPE) != (n == 3) ||
+        (n == 3 && arg[1] != '\0'))
+    {
+      bad = lineno;
+      break;
+    }
+    b.ch = b.action == ACT_TYPE ? arg[0] : 0;
+    km->keys[mods][keycode] = b;
+  }
+  fclose(fp);
+  return bad;
+}
+
+/*
+ * What the key does with these modifiers down.  Caps lock counts as
+ * shift, as it always has here.
+ */
+const struct key_binding *keymapLookup(const struct keymap *km, uint8_t modifiers,
+                                       bool caps_lock, uint8_t keycode)
+{
+  unsigned mods = ((modifiers & (USB_LSHIFT | USB_RSHIFT)) || caps_lock ? KEYMAP_SHIFT : 0) |
+                  (modifiers & (USB_LCTRL | USB_RCTRL) ? KEYMAP_CTRL : 0) |
+                  (modifiers & (USB_LALT | USB_RALT) ? KEYMAP_ALT : 0);
+
+  return &km->keys[mods][keycode];
+}
@@ -0,0 +1,66 @@
+#ifndef _KEYMAP_H
+#define _KEYMAP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define KEYMAP_SHIFT (1 << 0) /* Either shift key, or caps lock on */
+#define KEYMAP_CTRL (1 << 1)
+#define KEYMAP_ALT (1 << 2)
+#define KEYMAP_MODS 8 /* Every combination of the above */
+
+#define CTRL_KEY(c) ((c) & 0x1f) /* What Ctrl with letter c types */
+
+/* What a key does; the editor has a handler for each */
+enum key_action
+{
+  ACT_NONE,
+  ACT_TYPE, /* Type the binding's character */
+  ACT_SEND,
+  ACT_BACKSPACE,
+  ACT_TAB,
+  ACT_LEFT,
+  ACT_RIGHT,
+  ACT_UP,
+  ACT_DOWN,
+  ACT_UNDO,
+  ACT_REDO,
+  ACT_INSERT,    /* Toggle insert/overtype */
+  ACT_CAPS_LOCK, /* Toggle caps lock */
+  ACT_PAGE_UP,
+  ACT_PAGE_DOWN,
+  ACT_QUIT,
+  ACT_SEARCH,     /* Start or stop searching the received text */
+  ACT_FIND_OLDER, /* Go to the previous match */
+  ACT_FIND_NEWER, /* Go to the next match */
+  ACT_COUNT,
+};
+
+struct key_binding
+{
+  uint8_t action; /* enum key_action */
+  char ch;        /* For ACT_TYPE */
+};
+
+/*
+ * Every key's binding under every combination of modifiers, so finding
+ * what a key does is one array index.  keymapInit() fills it with the
+ * usual US layout; keymapLoad() then changes what a bindings file says.
+ * A file has one binding per line, modifiers joined to the key with +,
+ * then the action, and for type the character:
+ *
+ *   ctrl+u undo
+ *   alt+1 type ~
+ *   f1 quit
+ *   esc none
+ */
+struct keymap
+{
+  struct key_binding keys[KEYMAP_MODS][256];
+};
+
+extern void keymapInit(struct keymap *km);
+extern int keymapLoad(struct keymap *km, const char *path);
+extern const struct key_binding *keymapLookup(const struct keymap *km, uint8_t modifiers,
+                                              bool caps_lock, uint8_t keycode);
+#endif
@@ -14,6 +14,23 @@
 #include "usbkeyboard.h"
 #include <pthread.h>
 #include <sys/ioctl.h>
+#include "hidreplay.h"
+#include "evdev.h"
+#include "metrics.h"
+#include "editor.h"
+#include "inputqueue.h"
+#include "network.h"
+#include "textbox.h"
+#include "scrollback.h"
+#include "search.h"
+#include "chatlog.h"
+#include <signal.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <stdarg.h>
 #define FBDEV "/dev/fb0"
 struct winsize w;
 // hardcoded max MAX_ROWS and MAX_COLS; 64 * 24
@@ -24,7 +41,10 @@ struct winsize w;
 /* arthur.cs.columbia.edu */
 #define SERVER_HOST "128.59.19.114"
 #define SERVER_PORT 42000
-#define BUFFER_SIZE 128
+#define CURSOR_BLINK_MS 500
+#define KEY_REPEAT_DELAY_MS 400 /* Arrow/backspace held this long starts repeating */
+#define KEY_REPEAT_RATE_MS 50
+#define MAX_EVENTS 8
 
 /*
  * References:
@@ -34,46 +54,87 @@ struct winsize w;
  *
  */
 
-int sockfd; /* Socket file descriptor */
+struct netconn server; /* Owned by the main loop */
+const char *server_status = "connecting";
 
 struct libusb_device_handle *keyboard;
 uint8_t endpoint_address;
 struct usb_keyboard_packet packet;
 int transferred;
 
-pthread_t network_thread_r;
-pthread_t network_thread_w;
 pthread_t keyboard_thread;
-pthread_mutex_t keyboard_lock;
 
-void *network_thread_f_r(void *);
-void *network_thread_f_w(void *);
+void showReceived(const char *line, size_t len);
+void addReceived(const char *line, size_t len);
 void *keyboard_thread_f(void *);
-void fbline(char c, int row);
-void fbputs(const char *s, int row, int col);
-char msg_buff[MESSAGE_SIZE + 2]; // +2 because we want to append \n \0
-char keys[MAX_KEYS_PRESSED];
-char keystate[12];
-char old_keys[MAX_KEYS_PRESSED];
-int modifierPressed = 0;
-
-struct position text_pos = {
-    .cursor_col_indx = TEXT_BOX_START_COLS,
-    .cursor_row_indx = TEXT_BOX_START_ROWS,
-    .msg_buff_col_indx = TEXT_BOX_START_COLS,
-    .msg_buff_row_indx = TEXT_BOX_START_ROWS,
-    .msg_buff_indx = 0,
-    .blinking = false,
+void handleInput(void);
+bool inputPending(void);
+void localFirst(struct epoll_event *events, int n);
+int parsePort(const char *s);
+void watchFd(int fd);
+void drainFd(int fd);
+void kickFd(int fd);
+void armTimer(int fd, long first_ms, long period_ms);
+void keyAction(enum key_action action);
+void findMatch(bool older);
+void showSearch(const char *fmt, ...);
+void showNetEvent(enum net_event ev);
+void showStatus(void);
+int openInput(void);
+
+/* Message box state, only ever touched by the main loop thread */
+struct editor editor;
+struct input_queue input_queue;
+atomic_bool input_done = false; /* Keyboard thread's source ran dry */
+
+/* Where keyboard reports come from (-i / -p) */
+enum input_source
+{
+  INPUT_USB,
+  INPUT_EVDEV,
+  INPUT_REPLAY,
 };
-
-struct position message_pos = {
-    .cursor_col_indx = MESSAGE_BOX_START_COLS,
-    .cursor_row_indx = MESSAGE_BOX_START_ROWS,
-    .msg_buff_col_indx = MESSAGE_BOX_START_COLS,
-    .msg_buff_row_indx = MESSAGE_BOX_START_ROWS,
-    .msg_buff_indx = 0,
-    .blinking = false,
+const char *input_source_names[] = {"libusb", "evdev", "replay"};
+enum input_source input_source = INPUT_USB;
+const char *replay_path = NULL, *evdev_path = NULL;
+const char *keyboard_cache = USB_KEYBOARD_CACHE;
+double replay_speed = 1.0;
+
+/* Set by the keyboard thread once it has opened its source, or failed to */
+enum keyboard_state
+{
+  KEYBOARD_OPENING,
+  KEYBOARD_READY,
+  KEYBOARD_FAILED,
 };
+const char *keyboard_state_names[] = {"searching", "ready", "not found"};
+atomic_int keyboard_state = KEYBOARD_OPENING;
+const char *net_backend_names[] = {"epoll", "io_uring"};
+struct evdev_keyboard evdev_kb;
+struct hid_replay replay;
+FILE *record_fp = NULL;
+
+/*
+  The main loop sleeps in epoll_wait on these and nothing else: the
+  keyboard and network threads kick an eventfd when they have something
+  for it, and the timerfds drive cursor blink and key repeat.
+*/
+int epfd;
+int input_efd;  /* Keyboard thread queued a report */
+int blink_tfd;  /* Cursor blink */
+int repeat_tfd; /* Held arrow/backspace repeat */
+int sig_fd;     /* SIGUSR1 (report), SIGINT/SIGTERM (quit) */
+int sync_tfd;   /* Chat log fdatasync() */
+bool sync_armed; /* sync_tfd is counting down */
+bool send_held;  /* Row 3 says the last message didn't fit the queue */
+
+struct text_box text_box; /* Lines from the server */
+struct scrollback history;
+struct search_index search_index; /* Over history */
+char search_query[SEARCH_MAX_QUERY]; /* What the last find looked for */
+size_t search_query_len;
+uint64_t search_at; /* Line it found */
+struct chatlog chat_log; /* Everything received, across runs (-L) */
 
 struct special_keys s_keys = {
     .caps_lock = false,
@@ -81,283 +142,763 @@ struct special_keys s_keys = {
     .up_arrow = false,
     .right_arrow = false,
     .left_arrow = false,
-    .shift_pressed = false,
     .backspace_pressed = false,
     .escape_pressed = false,
     .insert = false};
 
-int main()
+/*
+  The port number in s, or -1 unless it is a number from 1 to 65535.
+*/
+int parsePort(const char *s)
+{
+  char *end;
+  long port;
+
+  errno = 0;
+  port = strtol(s, &end, 10);
+  if (errno != 0 || end == s || *end != '\0' || port < 1 || port > 65535)
+    return -1;
+  return port;
+}
+
+void usage(const char *prog)
+{
+  fprintf(stderr, "Usage: %s [-a address] [-P port] [-i usb|evdev] [-d device] [-r record_file] [-p replay_file [-x speed]] [-b kib] [-n epoll|uring] [-k cache_file] [-H history_file] [-K bindings_file] [-L log_file]\n", prog);
+  fprintf(stderr, "  -a ADDR   chat server IP address (default %s)\n", SERVER_HOST);
+  fprintf(stderr, "  -P PORT   chat server port (default %d)\n", SERVER_PORT);
+  fprintf(stderr, "  -i SRC    keyboard source: usb (libusb, default) or evdev (/dev/input)\n");
+  fprintf(stderr, "  -d DEV    evdev device to use instead of every keyboard found\n");
+  fprintf(stderr, "  -r FILE   record every keyboard report to FILE (replacing it)\n");
+  fprintf(stderr, "  -p FILE   replay reports from FILE instead of the USB keyboard\n");
+  fprintf(stderr, "  -x SPEED  replay speed: 1 = as recorded, N = N times faster, 0 = no delay\n");
+  fprintf(stderr, "  -b KIB    scrollback memory cap (default %d, %d to %d)\n",
+          SCROLLBACK_DEFAULT_BYTES / 1024, SCROLLBACK_MIN_BYTES / 1024, SCROLLBACK_MAX_BYTES / 1024);
+  fprintf(stderr, "  -n IO     server socket I/O: epoll (default) or uring (io_uring, falls back to epoll)\n");
+  fprintf(stderr, "  -k FILE   remember the USB keyboard here to skip the scan next time\n");
+  fprintf(stderr, "            (default %s, \"\" to always scan)\n", USB_KEYBOARD_CACHE);
+  fprintf(stderr, "  -H FILE   keep sent messages here so Up can recall them after a restart\n");
+  fprintf(stderr, "  -K FILE   key bindings to use instead of the built-in ones (see keymap.h)\n");
+  fprintf(stderr, "  -L FILE   log everything received here, and show its end again at startup\n");
+}
+
+int main(int argc, char *argv[])
 {
-  int err, col;
+  int err, col, opt, bad_line;
   struct sockaddr_in serv_addr;
+  const char *record_path = NULL, *sent_path = NULL, *keymap_path = NULL, *log_path = NULL;
+  const char *server_host = SERVER_HOST;
+  int server_port = SERVER_PORT;
+  size_t history_bytes = SCROLLBACK_DEFAULT_BYTES;
+  long kib;
+  char *end;
+  enum net_backend net_backend = NET_EPOLL;
+  bool behind = false; /* Received lines or text box rows still to do */
+
+  startup_ns = monotonicNs();
+  while ((opt = getopt(argc, argv, "a:P:i:d:r:p:x:b:n:k:H:K:L:h")) != -1)
+  {
+    switch (opt)
+    {
+    case 'a':
+      server_host = optarg;
+      break;
+    case 'P':
+      if ((server_port = parsePort(optarg)) < 0)
+      {
+        usage(argv[0]);
+        exit(1);
+      }
+      break;
+    case 'i':
+      if (strcmp(optarg, "evdev") == 0)
+        input_source = INPUT_EVDEV;
+      else if (strcmp(optarg, "usb") == 0)
+        input_source = INPUT_USB;
+      else
+      {
+        usage(argv[0]);
+        exit(1);
+      }
+      break;
+    case 'k':
+      keyboard_cache = *optarg ? optarg : NULL;
+      break;
+    case 'H':
+      sent_path = optarg;
+      break;
+    case 'K':
+      keymap_path = optarg;
+      break;
+    case 'L':
+      log_path = optarg;
+      break;
+    case 'd':
+      evdev_path = optarg;
+      break;
+    case 'r':
+      record_path = optarg;
+      break;
+    case 'p':
+      replay_path = optarg;
+      input_source = INPUT_REPLAY;
+      break;
+    case 'x':
+      replay_speed = atof(optarg);
+      break;
+    case 'b':
+      errno = 0;
+      kib = strtol(optarg, &end, 10);
+      if (errno != 0 || end == optarg || *end != '\0' || kib <= 0)
+      {
+        usage(argv[0]);
+        exit(1);
+      }
+      /* scrollbackInit() brings it within range; this only avoids overflow */
+      history_bytes = (size_t)kib < SCROLLBACK_MAX_BYTES / 1024 ? (size_t)kib * 1024
+                                                                : SCROLLBACK_MAX_BYTES;
+      break;
+    case 'n':
+      if (strcmp(optarg, "uring") == 0)
+        net_backend = NET_URING;
+      else if (strcmp(optarg, "epoll") == 0)
+        net_backend = NET_EPOLL;
+      else
+      {
+        usage(argv[0]);
+        exit(1);
+      }
+      break;
+    default:
+      usage(argv[0]);
+      exit(opt == 'h' ? 0 : 1);
+    }
+  }
 
-  if ((err = fbopen()) != 0)
+  /* Get the server address */
+  memset(&serv_addr, 0, sizeof(serv_addr));
+  serv_addr.sin_family = AF_INET;
+  serv_addr.sin_port = htons(server_port);
+  if (inet_pton(AF_INET, server_host, &serv_addr.sin_addr) <= 0)
   {
-    fprintf(stderr, "Error: Could not open framebuffer: %d\n", err);
+    fprintf(stderr, "Error: Could not convert host IP \"%s\"\n", server_host);
     exit(1);
   }
-  clearScreen();
-  /* Draw MAX_ROWS of asterisks across the top and bottom of the screen */
-  for (col = 0; col < MAX_COLS; col++)
+  if (record_path != NULL && (record_fp = hidRecordOpen(record_path)) == NULL)
   {
-    fbputchar('*', 0, col);
-    fbputchar('*', MAX_ROWS - 1, col);
+    fprintf(stderr, "Error: Could not create record file \"%s\"\n", record_path);
+    exit(1);
   }
-  fbputs("Hello CSEE 4840 World!", 4, 10);
-  fbline('-', MAX_ROWS - 4);
-
-  /*reset message buffers*/
-  fbline(' ', MAX_ROWS - 3);
-  fbline(' ', MAX_ROWS - 2);
-
-  /* Open the keyboard */
-  if ((keyboard = openkeyboard(&endpoint_address)) == NULL)
+  if (editorInit(&editor, sent_path) != 0)
   {
-    fprintf(stderr, "Did not find a keyboard\n");
+    fprintf(stderr, "Error: Could not open sent message history \"%s\"\n", sent_path);
+    exit(1);
+  }
+  editor.app_action = keyAction;
+  if (keymap_path != NULL && (bad_line = keymapLoad(&editor.keymap, keymap_path)) != 0)
+  {
+    if (bad_line < 0)
+      fprintf(stderr, "Error: Could not read key bindings \"%s\"\n", keymap_path);
+    else
+      fprintf(stderr, "Error: %s:%d: bad key binding\n", keymap_path, bad_line);
+    exit(1);
+  }
+  if (scrollbackInit(&history, history_bytes) != 0)
+  {
+    fprintf(stderr, "Error: Could not allocate %zu bytes of scrollback\n", history_bytes);
+    exit(1);
+  }
+  textBoxInit(&text_box, &history);
+  searchIndexInit(&search_index);
+  if (chatlogOpen(&chat_log, log_path, TEXT_BOX_ROWS, addReceived) != 0)
+  {
+    fprintf(stderr, "Error: Could not open chat log \"%s\"\n", log_path);
     exit(1);
   }
 
-  /* Create a TCP communications socket */
-  if ((sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+  /* Set up everything the main loop waits on */
+  sigset_t sigs;
+  sigemptyset(&sigs);
+  sigaddset(&sigs, SIGUSR1); /* kill -USR1 dumps metrics without stopping */
+  sigaddset(&sigs, SIGINT);
+  sigaddset(&sigs, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &sigs, NULL); /* Inherited by the threads below */
+  if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+      (input_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0 ||
+      (blink_tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0 ||
+      (repeat_tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0 ||
+      (sig_fd = signalfd(-1, &sigs, SFD_NONBLOCK | SFD_CLOEXEC)) < 0 ||
+      (sync_tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
   {
-    fprintf(stderr, "Error: Could not create socket\n");
+    perror("Error: main loop setup");
     exit(1);
   }
+  watchFd(input_efd);
+  watchFd(blink_tfd);
+  watchFd(repeat_tfd);
+  watchFd(sig_fd);
+  watchFd(sync_tfd);
 
-  /* Get the server address */
-  memset(&serv_addr, 0, sizeof(serv_addr));
-  serv_addr.sin_family = AF_INET;
-  serv_addr.sin_port = htons(SERVER_PORT);
-  if (inet_pton(AF_INET, SERVER_HOST, &serv_addr.sin_addr) <= 0)
+  /*
+    The slow parts of startup run side by side: the keyboard thread
+    opens its device (a full USB enumeration for libusb) while the
+    server connect goes on in the background, and meanwhile the screen
+    is drawn.  Each one's status turns live as the main loop hears it's
+    done.
+  */
+  pthread_create(&keyboard_thread, NULL, keyboard_thread_f, NULL);
+  if (netConnect(&server, epfd, &serv_addr, net_backend, showReceived, inputPending) != 0)
   {
-    fprintf(stderr, "Error: Could not convert host IP \"%s\"\n", SERVER_HOST);
+    perror("Error: could not start connecting to the server");
     exit(1);
   }
+  if (net_backend == NET_URING && server.backend != NET_URING)
+    fprintf(stderr, "io_uring is not available here, using epoll\n");
 
-  /* Connect the socket to the server */
-  if (connect(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
+  if ((err = fbopen()) != 0)
   {
-    fprintf(stderr, "Error: connect() failed.  Is the server running?\n");
+    fprintf(stderr, "Error: Could not open framebuffer: %d\n", err);
     exit(1);
   }
-  if (pthread_mutex_init(&keyboard_lock, NULL) != 0)
+  clearScreen();
+  /* Draw MAX_ROWS of asterisks across the top and bottom of the screen */
+  for (col = 0; col < MAX_COLS; col++)
   {
-    printf("\n mutex init has failed\n");
-    return 1;
+    fbputchar('*', 0, col);
+    fbputchar('*', MAX_ROWS - 1, col);
   }
+  fbputs("Hello CSEE 4840 World!", 4, 10);
+  fbline('-', MAX_ROWS - 4);
 
-  /* Start the network thread */
-  pthread_create(&network_thread_r, NULL, network_thread_f_r, NULL);
-  pthread_create(&keyboard_thread, NULL, keyboard_thread_f, NULL);
-  // pthread_create(&network_thread_w, NULL, network_thread_f_w, NULL);
+  /*reset message buffers*/
+  fbline(' ', MAX_ROWS - 3);
+  fbline(' ', MAX_ROWS - 2);
+  showStatus();
+  textBoxRender(&text_box, NULL); /* What the chat log had */
+  first_frame_ns = monotonicNs() - startup_ns;
+  armTimer(blink_tfd, CURSOR_BLINK_MS, CURSOR_BLINK_MS);
 
   /* Look for and handle keypresses */
+  loop_start_ns = monotonicNs();
   for (;;)
   {
-    // printf("Locking\n");
-    pthread_mutex_lock(&keyboard_lock);
-    // RESET_BACKSPACE(s_keys);
-    // RESET_ARROW_KEYS(s_keys)
-    // printf("Cursor pos: (rows, cols, blink): (%d, %d, %d)\n", message_pos.cursor_row_indx, message_pos.cursor_col_indx, message_pos.blinking);
-    if (ESC_PRESSED(s_keys))
-    { /* ESC pressed? */
-      // printf("Unlocking Thread\n");
-      pthread_mutex_unlock(&keyboard_lock);
+    struct epoll_event events[MAX_EVENTS];
+    struct signalfd_siginfo si;
+    bool quit = false, idle = true;
+    /* Don't sleep on work that was cut short for typing */
+    int n = epoll_wait(epfd, events, MAX_EVENTS, behind ? 0 : -1);
+
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      perror("Error: epoll_wait");
       break;
     }
-    else if (ARROW_KEYS_PRESSED(s_keys))
+    loop_wakeups++;
+
+    /*
+      Work goes in order of how much a delay would be noticed.  First
+      local echo and the cursor: key reports (whose repaint of the
+      message box comes with them), key repeat and blink.  Then
+      everything else, where received lines are laid out but stop
+      between lines as soon as a key report is queued, and last the
+      text box is drawn, which stops between rows the same way.
+      Whatever was stopped carries on next pass, after the keys.
+    */
+    localFirst(events, n);
+    for (int i = 0; i < n; i++)
     {
-      handleArrowKeys(&message_pos, &s_keys);
+      int fd = events[i].data.fd;
+      if (fd == input_efd)
+      {
+        idle = false;
+        drainFd(fd);
+        if (keyboard_ready_ns == 0 && atomic_load(&keyboard_state) != KEYBOARD_OPENING)
+        {
+          keyboard_ready_ns = monotonicNs() - startup_ns;
+          showStatus();
+        }
+        handleInput();
+      }
+      else if (netOwnsFd(&server, fd))
+      {
+        idle = false;
+        showNetEvent(netHandleEvents(&server, fd, events[i].events));
+      }
+      else if (fd == server.retry_tfd)
+        showNetEvent(netHandleTimer(&server));
+      else if (fd == repeat_tfd)
+      {
+        idle = false;
+        drainFd(fd);
+        editorHeldKeys(&editor);
+        armTimer(blink_tfd, CURSOR_BLINK_MS, CURSOR_BLINK_MS);
+      }
+      else if (fd == blink_tfd)
+      {
+        drainFd(fd);
+        editorBlink(&editor);
+      }
+      else if (fd == sync_tfd)
+      {
+        drainFd(fd);
+        sync_armed = false;
+        chatlogSync(&chat_log);
+      }
+      else if (fd == sig_fd && read(sig_fd, &si, sizeof(si)) == sizeof(si))
+      {
+        if (si.ssi_signo == SIGUSR1)
+          metricsReport(stderr);
+        else
+          quit = true;
+      }
     }
-    else if (BACKSPACE_PRESSED(s_keys))
+    /* Received lines held back last pass, if nothing above took them */
+    if (behind)
     {
-      handleBackSpace(&message_pos);
+      idle = false;
+      netResume(&server);
     }
-    else if (USB_NOTHING_PRESSED(keys))
+
+    /* Everything typed this pass goes out together */
+    showNetEvent(netFlush(&server));
+
+    /* Draw what arrived, at most a screen's worth, until a key comes in */
+    behind = !textBoxRender(&text_box, inputPending) || netBacklog(&server);
+
+    /* And everything received goes into the log with one write, on the
+       disk within CHATLOG_SYNC_MS */
+    chatlogFlush(&chat_log);
+    if (chat_log.unsynced && !sync_armed)
     {
-      // printf("RESETING KEYS\n");
-      RESET_SPECIAL_KEYS(s_keys); // Keeps caps lock intact
-      handleCursorBlink(&message_pos, &msg_buff);
-      usleep(DELAY);
-      handleCursorBlink(&message_pos, &msg_buff);
+      armTimer(sync_tfd, CHATLOG_SYNC_MS, 0);
+      sync_armed = true;
     }
-    // printf("Unlocking\n");
-    pthread_mutex_unlock(&keyboard_lock);
-    usleep(DELAY);
+    if (ESC_PRESSED(s_keys))
+      quit = true;
+
+    if (idle)
+      idle_wakeups++;
+    if (quit)
+      break;
   }
 
-  /* Terminate the network thread */
-  pthread_cancel(network_thread_r);
+  /* Terminate the keyboard thread */
   pthread_cancel(keyboard_thread);
-  // pthread_cancel(network_thread_w);
-
-  /* Wait for the network thread to finish */
-  pthread_join(network_thread_r, NULL);
   pthread_join(keyboard_thread, NULL);
-  // pthread_join(network_thread_w, NULL);
-  pthread_mutex_destroy(&keyboard_lock);
+  netClose(&server);
+  hidRecordClose(record_fp);
+  msgHistClose(&editor.history);
+  chatlogClose(&chat_log);
+  fprintf(stderr, "Input source: %s\n", input_source_names[input_source]);
+  fprintf(stderr, "Network backend: %s\n", net_backend_names[server.backend]);
+  metricsReport(stderr);
+  if (atomic_load(&keyboard_state) != KEYBOARD_READY)
+    return 1;
+  if (input_source == INPUT_REPLAY)
+  {
+    fprintf(stderr, "Replayed %lu reports\n", replay.replayed);
+    hidReplayClose(&replay);
+  }
+  else if (input_source == INPUT_EVDEV)
+  {
+    histPrint(stderr, "evdev kernel-to-read", &evdev_kb.latency);
+    evdevClose(&evdev_kb);
+  }
   return 0;
 }
 
-void *keyboard_thread_f(void *ignored)
+/*
+  Open whichever input source was chosen.  Returns 0 on success, -1
+  (having said why) on failure.
+*/
+int openInput()
 {
-  
-  for (;;)
+  if (input_source == INPUT_REPLAY)
   {
-    sprintf(keystate, "%02x %02x %02x", packet.modifiers, packet.keycode[0],
-            packet.keycode[1]);
-    printf("%s\n", keystate);
+    if (hidReplayOpen(&replay, replay_path, replay_speed) != 0)
+    {
+      fprintf(stderr, "Error: Could not open replay file \"%s\"\n", replay_path);
+      return -1;
+    }
+  }
+  else if (input_source == INPUT_EVDEV)
+  {
+    if (evdevOpen(&evdev_kb, evdev_path) != 0)
+    {
+      fprintf(stderr, "Did not find an evdev keyboard\n");
+      return -1;
+    }
+  }
+  else if ((keyboard = openkeyboard(&endpoint_address, keyboard_cache)) == NULL)
+  {
+    fprintf(stderr, "Did not find a keyboard\n");
+    return -1;
+  }
+  return 0;
+}
+
+/*
+  Get the next report from whichever input source is active.  Returns 1
+  with packet filled in, 0 if the transfer failed and -1 once the source
+  has nothing more to give (end of a recording, keyboards unplugged).
+*/
+int readKeyboardPacket()
+{
+  switch (input_source)
+  {
+  case INPUT_REPLAY:
+    return hidReplayNext(&replay, &packet) ? 1 : -1;
+  case INPUT_EVDEV:
+    return evdevNextPacket(&evdev_kb, &packet) ? 1 : -1;
+  default:
     libusb_interrupt_transfer(keyboard, endpoint_address,
                               (unsigned char *)&packet, sizeof(packet),
                               &transferred, 0);
-    if (transferred == sizeof(packet))
+    return transferred == sizeof(packet);
+  }
+}
+
+void watchFd(int fd)
+{
+  struct epoll_event ev = {.events = EPOLLIN, .data.fd = fd};
+  epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/*
+  Reset an eventfd/timerfd so it stops polling readable
+*/
+void drainFd(int fd)
+{
+  uint64_t count;
+  while (read(fd, &count, sizeof(count)) == sizeof(count))
+    ;
+}
+
+void kickFd(int fd)
+{
+  uint64_t one = 1;
+  write(fd, &one, sizeof(one));
+}
+
+/*
+  Start a timerfd: first expiry after first_ms, then every period_ms.
+  Zero for both disarms it.
+*/
+void armTimer(int fd, long first_ms, long period_ms)
+{
+  struct itimerspec its = {
+      .it_value = {.tv_sec = first_ms / 1000, .tv_nsec = (first_ms % 1000) * 1000000L},
+      .it_interval = {.tv_sec = period_ms / 1000, .tv_nsec = (period_ms % 1000) * 1000000L},
+  };
+  timerfd_settime(fd, 0, &its, NULL);
+}
+
+/*
+  Key actions the editor hands back.  Paging only moves the text box's
+  view; it is drawn at the end of the loop pass.
+*/
+void keyAction(enum key_action action)
+{
+  switch (action)
+  {
+  case ACT_PAGE_UP:
+    textBoxPageUp(&text_box);
+    break;
+  case ACT_PAGE_DOWN:
+    textBoxPageDown(&text_box);
+    break;
+  case ACT_QUIT:
+    s_keys.escape_pressed = true;
+    break;
+  case ACT_SEARCH:
+    if (editor.searching)
+      showSearch("Search: type, then Enter");
+    else
     {
-      printf("Getting lock Thread\n");
-      pthread_mutex_lock(&keyboard_lock);
-      getCharsFromPacket(&packet, &keys); // packet.keystate
-      setSpecialKeys(&packet, &s_keys);
-      printSpecialKeys(&s_keys);
-      fbputs(keystate, 6, 0);
-      int key_index = -1;
-      int seen = 0;
-      for (int cur_index = 0; cur_index < 3; cur_index++)
-      {
-        printf("Key %c\n", packet.keycode[key_index]);
-        for (int old_index = 0; old_index < 3; old_index++)
-        {
-          if (packet.keycode[cur_index] == old_keys[old_index])
-          {
-            printf("Key debug: %c, %c\n", packet.keycode[cur_index], old_keys[old_index]);
-            seen = 1;
-          }
-        }
-        if (!seen && packet.keycode[cur_index] != '\0') {
-          printf("Seen %d\n", cur_index);
-          key_index = cur_index;
-        }
-        seen = 0;
-      }
-      //if (packet.modifiers)
-      char key;
-      if (key_index == -1) key = '\0';
-      else key = getCharFromKeyCode(packet.modifiers, packet.keycode[key_index]);
-
-      printf("%c: %d %d\n", key, key_index, seen);
-      if (!key)
-        goto fail;
-      /* write the char to the message buffer and print to the correct position on screen */
-      if (key == '\n'){
-        // memset(msg_buff, 0, sizeof(msg_buff));
-        handleEnterKey(&message_pos);
-      }
-      else if (key == '\b')
-        handleBackSpace(&message_pos);
-      else if (key == '\t')
-      {
-        for (int i = 0; i < TAB_SPACING; i++)
-        {
-          printChar(&message_pos, &s_keys, &msg_buff, ' ');
-        }
-      }
-      else{
-        printChar(&message_pos, &s_keys, &msg_buff, key);
-      }
+      /* Done: back to the newest lines */
+      search_query_len = 0;
+      textBoxHighlight(&text_box, NULL, 0);
+      textBoxLive(&text_box);
+      showSearch("");
     }
-    fail:
-      memcpy(old_keys, packet.keycode, sizeof(packet.keycode));
-      //memcpy(old_keys, keys, sizeof(keys));
-      printf("Unlocking Thread\n");
-      pthread_mutex_unlock(&keyboard_lock);
+    break;
+  case ACT_FIND_OLDER:
+  case ACT_FIND_NEWER:
+    findMatch(action == ACT_FIND_OLDER);
+    break;
+  default:
+    break;
   }
 }
 
 /*
-  Read message from the network and print it to the
-  textbox screen
+  Look for what is typed in the message box: a new query starts from
+  the newest line, the same one again goes on from the last line found.
+  The line found is shown at the bottom of the text box with every
+  match picked out.
 */
-void *network_thread_f_r(void *ignored)
+void findMatch(bool older)
 {
-  /*
-    buffer size = 128 chars
-  */
-  char recvBuf[BUFFER_SIZE + 2];
-  int n;
-  /* Receive data */
-  while ((n = read(sockfd, &recvBuf, BUFFER_SIZE)) > 0) // leave the last index for end string
+  char query[SEARCH_MAX_QUERY];
+  size_t len = gapLength(&editor.msg);
+  uint64_t from, hit, start = monotonicNs();
+
+  if (!editor.searching)
+    return;
+  if (len > sizeof(query))
+    len = sizeof(query);
+  for (size_t i = 0; i < len; i++)
+    query[i] = gapCharAt(&editor.msg, i);
+  if (len != search_query_len || memcmp(query, search_query, len) != 0)
   {
-    recvBuf[n] = '\n';
-    recvBuf[n + 1] = '\0';
-    /*
-      put the string in the frame buffer at the current text position
-      :: text position is
-    */
-    fbPutString(recvBuf, &text_pos);
+    memcpy(search_query, query, len);
+    search_query_len = len;
+    from = scrollbackEnd(&history);
+    older = true;
+  }
+  else
+    from = search_at;
+
+  if (!searchFind(&search_index, &history, query, len, from, older, &hit))
+  {
+    showSearch("Search: %s", from == scrollbackEnd(&history) ? "no match"
+                             : older ? "no older match" : "no newer match");
+    return;
+  }
+  search_at = hit;
+  textBoxHighlight(&text_box, query, len);
+  textBoxShowLine(&text_box, hit);
+  showSearch("Search: line %llu, %.2fms", (unsigned long long)hit + 1,
+             (monotonicNs() - start) / 1e6);
+}
+
+/*
+  Apply everything the keyboard thread has queued.  Arrow keys and
+  backspace act once when they go down and then repeat off repeat_tfd
+  for as long as they stay down.
+*/
+void handleInput()
+{
+  struct key_report report;
+  bool burst = false;
+  /* Read before draining: once it is set every report has been queued */
+  bool done = atomic_load(&input_done);
+
+  while (inputQueuePop(&input_queue, &report))
+  {
+    uint8_t held_before = editor.held;
+
+    /* More behind this one: apply them all, then draw once */
+    if (!burst && !inputQueueEmpty(&input_queue))
+    {
+      editorBeginBurst(&editor);
+      burst = true;
+    }
+    if (burst)
+      burst_reports++;
+    editorApplyReport(&editor, &report);
+
+    if (editor.held & ~held_before)
+    {
+      armTimer(repeat_tfd, KEY_REPEAT_DELAY_MS, KEY_REPEAT_RATE_MS);
+      armTimer(blink_tfd, CURSOR_BLINK_MS, CURSOR_BLINK_MS);
+    }
+    else if (!editor.held)
+      armTimer(repeat_tfd, 0, 0);
   }
-  return NULL;
+  if (burst)
+    editorEndBurst(&editor);
+  /* Input source is exhausted: quit the same way ESC does */
+  if (done)
+    s_keys.escape_pressed = true;
 }
 
 /*
-  function appears unused ask Tyler
-  Done till here
+  Move the events for the keyboard and its timers to the front, in the
+  order they came.
 */
-void *network_thread_f_w(void *ignored)
+void localFirst(struct epoll_event *events, int n)
 {
-  return NULL;
+  struct epoll_event rest[MAX_EVENTS];
+  int local = 0, others = 0;
+
+  for (int i = 0; i < n; i++)
+  {
+    int fd = events[i].data.fd;
+    if (fd == input_efd || fd == repeat_tfd || fd == blink_tfd)
+      events[local++] = events[i];
+    else
+      rest[others++] = events[i];
+  }
+  memcpy(events + local, rest, others * sizeof(*rest));
 }
 
 /*
-  Send message in message buffer to chatroom
+  Whether a key report is waiting: received lines and text box drawing
+  give way to it.
 */
-void sendMsg()
+bool inputPending(void)
 {
-  /*
-    Append newline and end string before sending message
-  */
-  if (message_pos.msg_buff_indx == 0) {
-    msg_buff[0] = '\n';
-    msg_buff[1] = 0;
-    printf("\n");
-    write(sockfd, msg_buff, 2);
-  } else if (message_pos.msg_buff_indx < MESSAGE_SIZE - 1)
+  return !inputQueueEmpty(&input_queue);
+}
+
+/*
+  Opens the input source, then reads reports and hands them to the main
+  loop, nothing more: the editor state belongs to the main loop thread.
+  Failing to open counts as the source running dry, after saying so.
+*/
+void *keyboard_thread_f(void *ignored)
+{
+  struct key_report report;
+  int r;
+
+  if (openInput() != 0)
   {
-    msg_buff[message_pos.msg_buff_indx] = '\n';
-    msg_buff[message_pos.msg_buff_indx + 1] = '\0';
-    printf("Message: %d %s", message_pos.msg_buff_indx, msg_buff);
-    write(sockfd, msg_buff, message_pos.msg_buff_indx + 1);
+    atomic_store(&keyboard_state, KEYBOARD_FAILED);
+    atomic_store(&input_done, true);
+    kickFd(input_efd);
+    return NULL;
   }
-  else
+  atomic_store(&keyboard_state, KEYBOARD_READY);
+  kickFd(input_efd);
+  for (;;)
   {
-    msg_buff[MESSAGE_SIZE + 1] = '\n';
-    msg_buff[MESSAGE_SIZE + 2] = '\0';
-    printf("Message: %d %s", message_pos.msg_buff_indx, msg_buff);
-    write(sockfd, msg_buff, MESSAGE_SIZE + 2);
+    if ((r = readKeyboardPacket()) < 0)
+    {
+      atomic_store(&input_done, true);
+      kickFd(input_efd);
+      return NULL;
+    }
+    if (r > 0)
+    {
+      report.arrived_ns = monotonicNs();
+      report.packet = packet;
+      if (record_fp != NULL)
+        hidRecordPacket(record_fp, &packet, report.arrived_ns);
+      inputQueuePush(&input_queue, &report);
+      kickFd(input_efd);
+    }
   }
 }
 
 /*
-  Debug print for special characters on screen
+  One line from the server: lay it out now, the main loop draws it (if
+  it's still on screen) and writes it to the chat log at the end of the
+  pass
 */
-void printSpecialKeys(struct special_keys *s_keys)
+void showReceived(const char *line, size_t len)
 {
-  char caps_insert[15];
-  sprintf(caps_insert, "CAPS LOCK %d", s_keys->caps_lock);
-  fbputs(caps_insert, 1, 50);
+  recv_lines++;
+  addReceived(line, len);
+  chatlogAppend(&chat_log, line, len);
+}
 
-  sprintf(caps_insert, "INSERT %d", s_keys->insert);
-  fbputs(caps_insert, 2, 50);
+/*
+  Into the text box, its history and the search index: a line from the
+  server, or one the chat log kept from before
+*/
+void addReceived(const char *line, size_t len)
+{
+  uint64_t n = scrollbackEnd(&history);
 
-  sprintf(caps_insert, "BACKSPACE %d", s_keys->backspace_pressed);
-  fbputs(caps_insert, 3, 50);
+  textBoxPutLine(&text_box, line, len);
+  searchIndexLine(&search_index, &history, n, line, len);
+}
 
-  sprintf(caps_insert, "LEFT ARROW %d", s_keys->left_arrow);
-  fbputs(caps_insert, 4, 50);
+/*
+  Tell the user when the server connection drops or comes back
+*/
+void showNetEvent(enum net_event ev)
+{
+  if (ev == NET_NONE)
+    return;
+  if (ev == NET_LOST)
+  {
+    textBoxPutString(&text_box, "*** Lost the server, reconnecting ***\n");
+    server_status = "reconnecting";
+  }
+  else
+  {
+    if (ev == NET_RECONNECTED)
+      textBoxPutString(&text_box, "*** Reconnected ***\n");
+    server_status = "connected";
+    if (server_ready_ns == 0)
+      server_ready_ns = monotonicNs() - startup_ns;
+  }
+  showStatus();
+}
+
+/*
+  Keyboard and server status in the top left corner.  Startup counts as
+  done, and the program interactive, once both are up.
+*/
+void showStatus()
+{
+  char line[32];
+
+  snprintf(line, sizeof(line), "Keyboard: %-12s", keyboard_state_names[atomic_load(&keyboard_state)]);
+  fbputs(line, 1, 1);
+  snprintf(line, sizeof(line), "Server:   %-12s", server_status);
+  fbputs(line, 2, 1);
+  if (interactive_ns == 0 && keyboard_ready_ns != 0 && server_ready_ns != 0 &&
+      atomic_load(&keyboard_state) == KEYBOARD_READY)
+    interactive_ns = monotonicNs() - startup_ns;
+}
 
-  sprintf(caps_insert, "UP ARROW %d", s_keys->up_arrow);
-  fbputs(caps_insert, 5, 50);
+/*
+  Search status on the line under the server status; "" clears it.
+*/
+void showSearch(const char *fmt, ...)
+{
+  char line[49];
+  va_list ap;
+
+  va_start(ap, fmt);
+  vsnprintf(line, sizeof(line), fmt, ap);
+  va_end(ap);
+  fbputs(line, 3, 1);
+  for (int col = 1 + strlen(line); col < 1 + (int)sizeof(line) - 1; col++)
+    fbputchar(' ', 3, col);
+}
 
-  sprintf(caps_insert, "DOWN_ARROW %d", s_keys->down_arrow);
-  fbputs(caps_insert, 6, 50);
+/*
+  Queue the message in the message buffer for the chatroom.  Never
+  blocks: the main loop writes it out as the socket allows, or once it
+  reconnects.  The network queue takes its own copy with the newline,
+  straight from the editor's buffer.  A message longer than the
+  protocol's lines goes as several in a row, so they are only queued
+  if the queue has room for all of them.  Returns false, leaving the
+  message with the caller, when it doesn't.
+*/
+bool sendMsg()
+{
+  size_t len, n;
+  const char *text = gapText(&editor.msg, &len);
+  size_t lines = len == 0 ? 1 : (len + NET_MAX_LINE - 1) / NET_MAX_LINE;
 
-  sprintf(caps_insert, "RIGHT ARROW %d", s_keys->right_arrow);
-  fbputs(caps_insert, 7, 50);
+  if (netRoom(&server) < lines)
+  {
+    showSearch("Send queue full, message kept");
+    send_held = true;
+    return false;
+  }
+  if (send_held)
+  {
+    showSearch("");
+    send_held = false;
+  }
+  do
+  {
+    n = len < NET_MAX_LINE ? len : NET_MAX_LINE;
+    netSendLine(&server, text, n);
+    text += n;
+    len -= n;
+  } while (len > 0);
+
+  /* More typing is already queued: let the end of the loop pass send
+     this together with whatever it produces, unless it's waited enough */
+  if (inputQueueEmpty(&input_queue) || netBatchDue(&server))
+    showNetEvent(netFlush(&server));
+  return true;
 }
@@ -0,0 +1,260 @@
+/*
+ * loadgen: simulated chat clients for load testing
+ *
+ * Opens N connections to the chat server and has each send fixed-size
+ * lines at a steady rate, reading and discarding whatever comes back.
+ * Run it against chatserver alongside lab2 -a 127.0.0.1 to see how the
+ * client copes with a busy room.
+ *
+ * Usage: loadgen [-a address] [-p port] [-n clients] [-r rate] [-s size] [-t seconds]
+ *
+ * References:
+ *
+ * man 7 epoll
+ * man 2 timerfd_create
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define DEFAULT_PORT 42000
+#define MAX_EVENTS 64
+#define TICK_NS 1000000 /* Sending is paced in 1 ms steps */
+#define MAX_LINE 4096
+
+struct sim_client
+{
+  int fd;
+  uint64_t sent;      /* Lines fully handed to the socket */
+  char pending[MAX_LINE];
+  size_t pending_len; /* Rest of a line the socket didn't take */
+};
+
+static uint64_t nowNs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+  Write what's left of the last line.  Returns -1 if the server hung up.
+*/
+static int flushPending(struct sim_client *c)
+{
+  while (c->pending_len > 0)
+  {
+    ssize_t n = send(c->fd, c->pending, c->pending_len, MSG_NOSIGNAL);
+    if (n > 0)
+    {
+      memmove(c->pending, c->pending + n, c->pending_len - n);
+      c->pending_len -= n;
+    }
+    else if (n < 0 && errno == EINTR)
+      continue;
+    else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return 0;
+    else
+      return -1;
+  }
+  return 0;
+}
+
+/*
+  The port number in s, or -1 unless it is a number from 1 to 65535.
+*/
+static int parsePort(const char *s)
+{
+  char *end;
+  long port;
+
+  errno = 0;
+  port = strtol(s, &end, 10);
+  if (errno != 0 || end == s || *end != '\0' || port < 1 || port > 65535)
+    return -1;
+  return port;
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr, "Usage: %s [-a address] [-p port] [-n clients] [-r rate] [-s size] [-t seconds]\n", prog);
+  fprintf(stderr, "  -a ADDR   chat server address (default 127.0.0.1)\n");
+  fprintf(stderr, "  -p PORT   chat server port (default %d)\n", DEFAULT_PORT);
+  fprintf(stderr, "  -n N      simulated clients (default 10)\n");
+  fprintf(stderr, "  -r RATE   lines per second per client (default 10)\n");
+  fprintf(stderr, "  -s SIZE   bytes per line, newline included (default 32)\n");
+  fprintf(stderr, "  -t SECS   how long to run (default 10)\n");
+}
+
+int main(int argc, char *argv[])
+{
+  const char *address = "127.0.0.1";
+  int port = DEFAULT_PORT, clients = 10, size = 32, opt, epfd, tfd, one = 1;
+  double rate = 10, seconds = 10;
+  struct sockaddr_in addr;
+  struct sim_client *sim;
+  struct itimerspec tick = {.it_interval = {0, TICK_NS}, .it_value = {0, TICK_NS}};
+  uint64_t start, elapsed, sent = 0, behind = 0, recv_bytes = 0, recv_lines = 0;
+  char line[MAX_LINE], buf[64 * 1024];
+
+  while ((opt = getopt(argc, argv, "a:p:n:r:s:t:h")) != -1)
+  {
+    switch (opt)
+    {
+    case 'a':
+      address = optarg;
+      break;
+    case 'p':
+      if ((port = parsePort(optarg)) < 0)
+      {
+        usage(argv[0]);
+        exit(1);
+      }
+      break;
+    case 'n':
+      clients = atoi(optarg);
+      break;
+    case 'r':
+      rate = atof(optarg);
+      break;
+    case 's':
+      size = atoi(optarg);
+      break;
+    case 't':
+      seconds = atof(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      exit(opt == 'h' ? 0 : 1);
+    }
+  }
+  if (clients < 1 || rate <= 0 || size < 2 || size > MAX_LINE || seconds <= 0)
+  {
+    usage(argv[0]);
+    exit(1);
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if (inet_pton(AF_INET, address, &addr.sin_addr) <= 0)
+  {
+    fprintf(stderr, "loadgen: bad address \"%s\"\n", address);
+    exit(1);
+  }
+  if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+      (tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) < 0 ||
+      (sim = calloc(clients, sizeof(*sim))) == NULL)
+  {
+    perror("loadgen: setup");
+    exit(1);
+  }
+
+  /* Connect everybody first so the rate isn't skewed by stragglers */
+  for (int i = 0; i < clients; i++)
+  {
+    struct epoll_event ev = {.events = EPOLLIN, .data.u32 = i};
+
+    if ((sim[i].fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0 ||
+        connect(sim[i].fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+      fprintf(stderr, "loadgen: client %d: connect: %s\n", i, strerror(errno));
+      exit(1);
+    }
+    setsockopt(sim[i].fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(sim[i].fd, F_SETFL, fcntl(sim[i].fd, F_GETFL) | O_NONBLOCK);
+    epoll_ctl(epfd, EPOLL_CTL_ADD, sim[i].fd, &ev);
+  }
+  {
+    struct epoll_event ev = {.events = EPOLLIN, .data.u32 = UINT32_MAX};
+    epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev);
+  }
+  timerfd_settime(tfd, 0, &tick, NULL);
+  fprintf(stderr, "loadgen: %d clients x %.1f lines/s x %d bytes for %.1fs\n",
+          clients, rate, size, seconds);
+
+  start = nowNs();
+  while ((elapsed = nowNs() - start) < seconds * 1e9)
+  {
+    struct epoll_event events[MAX_EVENTS];
+    int n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+
+    for (int e = 0; e < n; e++)
+    {
+      uint32_t i = events[e].data.u32;
+      uint64_t expirations;
+
+      if (i != UINT32_MAX)
+      {
+        /* Broadcasts coming back: count them and throw them away */
+        ssize_t got;
+        while ((got = read(sim[i].fd, buf, sizeof(buf))) > 0)
+        {
+          recv_bytes += got;
+          for (char *p = buf; (p = memchr(p, '\n', buf + got - p)) != NULL; p++)
+            recv_lines++;
+        }
+        if (got == 0)
+        {
+          fprintf(stderr, "loadgen: client %u: server hung up\n", i);
+          exit(1);
+        }
+        continue;
+      }
+
+      /* Tick: bring every client up to the number of lines it owes by now */
+      if (read(tfd, &expirations, sizeof(expirations)) < 0)
+        continue;
+      for (int c = 0; c < clients; c++)
+      {
+        uint64_t due = (uint64_t)(elapsed / 1e9 * rate);
+
+        if (flushPending(&sim[c]) < 0)
+        {
+          fprintf(stderr, "loadgen: client %d: send failed\n", c);
+          exit(1);
+        }
+        while (sim[c].sent < due && sim[c].pending_len == 0)
+        {
+          int len = snprintf(line, sizeof(line), "loadgen %d %llu ", c,
+                             (unsigned long long)sim[c].sent);
+          if (len > size - 1)
+            len = size - 1;
+          memset(line + len, 'x', size - 1 - len);
+          line[size - 1] = '\n';
+          memcpy(sim[c].pending, line, size);
+          sim[c].pending_len = size;
+          sim[c].sent++;
+          sent++;
+          if (flushPending(&sim[c]) < 0)
+          {
+            fprintf(stderr, "loadgen: client %d: send failed\n", c);
+            exit(1);
+          }
+        }
+        if (sim[c].sent < due)
+          behind += due - sim[c].sent;
+      }
+    }
+  }
+
+  elapsed = nowNs() - start;
+  printf("sent %llu lines (%.0f/s, %.2f MB/s), received %llu lines (%.0f/s)\n",
+         (unsigned long long)sent, sent / (elapsed / 1e9),
+         sent * (double)size / (elapsed / 1e3),
+         (unsigned long long)recv_lines, recv_lines / (elapsed / 1e9));
+  if (behind > 0)
+    printf("socket backpressure held back %llu line-ticks\n", (unsigned long long)behind);
+  return 0;
+}
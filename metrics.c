@@ -0,0 +1,203 @@
+/*
+ * metrics: timing helpers and the counters lab2 reports on SIGUSR1
+ * and at exit
+ */
+#include "metrics.h"
+
+#include <time.h>
+#include <sys/resource.h>
+
+struct histogram keystroke_latency;
+struct histogram input_latency;
+struct histogram send_latency;
+uint64_t sendq_depth;
+uint64_t sendq_depth_max;
+uint64_t send_dropped;
+uint64_t send_syscalls;
+uint64_t send_messages;
+uint64_t send_bytes;
+struct histogram reconnect_latency;
+uint64_t connections_lost;
+uint64_t connect_attempts;
+uint64_t connect_timeouts;
+uint64_t recv_syscalls;
+uint64_t text_rows_laid;
+uint64_t text_rows_drawn;
+uint64_t render_preempted;
+struct histogram render_latency;
+uint64_t layout_lines;
+uint64_t layout_rows;
+uint64_t layout_ns;
+uint64_t scrollback_lines;
+uint64_t scrollback_used;
+uint64_t scrollback_allocated;
+uint64_t scrollback_evicted;
+uint64_t recv_bytes;
+uint64_t recv_lines;
+uint64_t recv_preempted;
+uint64_t typed_chars;
+uint64_t typing_start_ns;
+uint64_t typing_end_ns;
+uint64_t input_bursts;
+uint64_t burst_reports;
+uint64_t message_cells_drawn;
+uint64_t editor_waits;
+uint64_t editor_wait_ns;
+struct histogram search_latency;
+uint64_t search_index_bytes;
+uint64_t chatlog_reload_ns;
+uint64_t chatlog_writes;
+uint64_t chatlog_syncs;
+uint64_t chatlog_bytes;
+uint64_t startup_ns;
+uint64_t first_frame_ns;
+uint64_t keyboard_ready_ns;
+uint64_t server_ready_ns;
+uint64_t interactive_ns;
+uint64_t keyboard_cache_hits;
+uint64_t keyboard_cache_misses;
+uint64_t loop_wakeups;
+uint64_t idle_wakeups;
+uint64_t loop_start_ns;
+
+uint64_t monotonicNs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned bucketOf(uint64_t value)
+{
+  unsigned msb, shift;
+
+  if (value < HIST_SUB_COUNT)
+    return value;
+  msb = 63 - __builtin_clzll(value);
+  shift = msb - HIST_SUB_BITS;
+  return (shift + 1) * HIST_SUB_COUNT + ((value >> shift) - HIST_SUB_COUNT);
+}
+
+/*
+  Highest value that lands in the given bucket
+*/
+static uint64_t bucketValue(unsigned bucket)
+{
+  unsigned shift;
+
+  if (bucket < HIST_SUB_COUNT)
+    return bucket;
+  shift = bucket / HIST_SUB_COUNT - 1;
+  return (((uint64_t)(bucket % HIST_SUB_COUNT + HIST_SUB_COUNT) + 1) << shift) - 1;
+}
+
+void histRecord(struct histogram *h, uint64_t value)
+{
+  h->counts[bucketOf(value)]++;
+  h->total++;
+  if (value > h->max)
+    h->max = value;
+}
+
+/*
+  Value at the given percentile (0-100), reported as the top of its
+  bucket but never above the largest value actually seen.
+*/
+uint64_t histPercentile(const struct histogram *h, double percentile)
+{
+  uint64_t rank, seen = 0;
+  unsigned b;
+
+  if (h->total == 0)
+    return 0;
+  rank = (uint64_t)(h->total * percentile / 100.0);
+  if (rank >= h->total)
+    rank = h->total - 1;
+  for (b = 0; b < HIST_BUCKETS; b++)
+  {
+    seen += h->counts[b];
+    if (seen > rank)
+      break;
+  }
+  return bucketValue(b) < h->max ? bucketValue(b) : h->max;
+}
+
+/*
+  One line summary of a nanosecond histogram, in microseconds
+*/
+void histPrint(FILE *fp, const char *name, const struct histogram *h)
+{
+  fprintf(fp, "%-24s n=%llu p50=%.1fus p99=%.1fus max=%.1fus\n", name,
+          (unsigned long long)h->total,
+          histPercentile(h, 50) / 1000.0,
+          histPercentile(h, 99) / 1000.0,
+          h->max / 1000.0);
+}
+
+void metricsReport(FILE *fp)
+{
+  double secs = loop_start_ns ? (monotonicNs() - loop_start_ns) / 1e9 : 0;
+  struct rusage ru;
+
+  histPrint(fp, "keystroke-to-pixel", &keystroke_latency);
+  histPrint(fp, "keystroke-to-editor", &input_latency);
+  fprintf(fp, "%-24s chars=%llu chars/s=%.0f bursts=%llu reports/burst=%.1f cells drawn=%llu\n",
+          "typing", (unsigned long long)typed_chars,
+          typing_end_ns > typing_start_ns ? typed_chars * 1e9 / (typing_end_ns - typing_start_ns) : 0.0,
+          (unsigned long long)input_bursts,
+          input_bursts ? (double)burst_reports / input_bursts : 0.0,
+          (unsigned long long)message_cells_drawn);
+  fprintf(fp, "%-24s waits=%llu total=%.1fus\n", "editor handoff",
+          (unsigned long long)editor_waits, editor_wait_ns / 1000.0);
+  histPrint(fp, "send queue latency", &send_latency);
+  fprintf(fp, "%-24s depth=%llu max=%llu dropped=%llu syscalls=%llu\n", "send queue",
+          (unsigned long long)sendq_depth, (unsigned long long)sendq_depth_max,
+          (unsigned long long)send_dropped, (unsigned long long)send_syscalls);
+  if (send_syscalls > 0)
+    fprintf(fp, "%-24s messages=%llu bytes=%llu syscalls/message=%.2f bytes/syscall=%.1f\n",
+            "send batching", (unsigned long long)send_messages,
+            (unsigned long long)send_bytes,
+            send_messages ? (double)send_syscalls / send_messages : 0.0,
+            (double)send_bytes / send_syscalls);
+  histPrint(fp, "reconnect time", &reconnect_latency);
+  fprintf(fp, "%-24s lost=%llu attempts=%llu timed out=%llu\n", "connection",
+          (unsigned long long)connections_lost, (unsigned long long)connect_attempts,
+          (unsigned long long)connect_timeouts);
+  fprintf(fp, "%-24s lines=%llu bytes=%llu syscalls=%llu syscalls/line=%.3f preempted=%llu\n",
+          "receive", (unsigned long long)recv_lines, (unsigned long long)recv_bytes,
+          (unsigned long long)recv_syscalls,
+          recv_lines ? (double)recv_syscalls / recv_lines : 0.0,
+          (unsigned long long)recv_preempted);
+  histPrint(fp, "text box render", &render_latency);
+  fprintf(fp, "%-24s laid out=%llu drawn=%llu preempted=%llu\n", "text box rows",
+          (unsigned long long)text_rows_laid, (unsigned long long)text_rows_drawn,
+          (unsigned long long)render_preempted);
+  fprintf(fp, "%-24s lines=%llu rows=%llu lines/s=%.0f\n", "text box layout",
+          (unsigned long long)layout_lines, (unsigned long long)layout_rows,
+          layout_ns ? layout_lines * 1e9 / layout_ns : 0.0);
+  fprintf(fp, "%-24s lines=%llu used=%.1fKiB allocated=%.1fKiB evicted=%llu\n", "scrollback",
+          (unsigned long long)scrollback_lines, scrollback_used / 1024.0,
+          scrollback_allocated / 1024.0, (unsigned long long)scrollback_evicted);
+  histPrint(fp, "search query", &search_latency);
+  fprintf(fp, "%-24s %.1fKiB\n", "search index", search_index_bytes / 1024.0);
+  fprintf(fp, "%-24s reload=%.2fms writes=%llu bytes=%llu syncs=%llu\n", "chat log",
+          chatlog_reload_ns / 1e6, (unsigned long long)chatlog_writes,
+          (unsigned long long)chatlog_bytes, (unsigned long long)chatlog_syncs);
+  fprintf(fp, "%-24s first frame=%.1fms keyboard=%.1fms (cache %s) server=%.1fms interactive=%.1fms\n",
+          "startup", first_frame_ns / 1e6, keyboard_ready_ns / 1e6,
+          keyboard_cache_hits ? "hit" : keyboard_cache_misses ? "miss" : "unused",
+          server_ready_ns / 1e6, interactive_ns / 1e6);
+  if (getrusage(RUSAGE_SELF, &ru) == 0)
+  {
+    double user = ru.ru_utime.tv_sec * 1e3 + ru.ru_utime.tv_usec / 1e3;
+    double sys = ru.ru_stime.tv_sec * 1e3 + ru.ru_stime.tv_usec / 1e3;
+    uint64_t messages = recv_lines + send_messages;
+    fprintf(fp, "%-24s user=%.1fms sys=%.1fms per 1k messages=%.2fms\n", "cpu",
+            user, sys, messages ? (user + sys) * 1000 / messages : 0.0);
+  }
+  if (secs > 0)
+    fprintf(fp, "%-24s total=%llu (%.2f/s) idle=%llu (%.2f/s)\n", "main loop wakeups",
+            (unsigned long long)loop_wakeups, loop_wakeups / secs,
+            (unsigned long long)idle_wakeups, idle_wakeups / secs);
+  fflush(fp);
+}
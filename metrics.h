@@ -0,0 +1,113 @@
+#ifndef _METRICS_H
+#define _METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * Log-linear latency histogram.  Values below HIST_SUB_COUNT are kept
+ * exactly; above that every power of two is split into HIST_SUB_COUNT
+ * linear buckets, so any recorded value is off by at most 1/16th.
+ * Recording is a couple of shifts and an increment.
+ */
+#define HIST_SUB_BITS 4
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+struct histogram
+{
+  uint64_t counts[HIST_BUCKETS];
+  uint64_t total;
+  uint64_t max;
+};
+
+/* Keystroke report arrival until its effect is in the framebuffer */
+extern struct histogram keystroke_latency;
+/* Keystroke report arrival until the editor has applied it */
+extern struct histogram input_latency;
+
+/* Characters typed, from the first to the last; with a replay at full
+   speed (-x 0) that is how fast the editor takes them in */
+extern uint64_t typed_chars;
+extern uint64_t typing_start_ns;
+extern uint64_t typing_end_ns;
+/* Passes that found several reports queued and drew once for all of them */
+extern uint64_t input_bursts;
+extern uint64_t burst_reports;
+extern uint64_t message_cells_drawn; /* Message box characters drawn */
+
+/* Keyboard thread blocked handing a report to the editor */
+extern uint64_t editor_waits;
+extern uint64_t editor_wait_ns;
+
+/* Queueing to the server until the last byte is written to the socket */
+extern struct histogram send_latency;
+extern uint64_t sendq_depth; /* Messages not fully sent yet */
+extern uint64_t sendq_depth_max;
+extern uint64_t send_dropped; /* Messages that didn't fit in the queue */
+extern uint64_t send_syscalls; /* sendmsg(), or io_uring_enter() with sends */
+extern uint64_t send_messages; /* Messages fully written */
+extern uint64_t send_bytes;
+
+/* Server connection drops, and how long each took to come back */
+extern struct histogram reconnect_latency;
+extern uint64_t connections_lost;
+extern uint64_t connect_attempts;
+extern uint64_t connect_timeouts; /* Attempts given up on after NET_CONNECT_MS */
+
+/* Data from the server */
+extern uint64_t recv_syscalls; /* read(), or io_uring_enter() re-arming the receive */
+extern uint64_t recv_bytes;
+extern uint64_t recv_lines;
+extern uint64_t recv_preempted; /* Times received lines were held back for typing */
+
+/* Received-text area: rows laid out, rows actually drawn, time per render,
+   renders cut short for typing */
+extern uint64_t text_rows_laid;
+extern uint64_t text_rows_drawn;
+extern uint64_t render_preempted;
+extern struct histogram render_latency;
+/* Word wrap of received lines: lines and rows laid out, time it took */
+extern uint64_t layout_lines;
+extern uint64_t layout_rows;
+extern uint64_t layout_ns;
+
+/* Scrollback store: lines held, bytes they take (text and index), bytes allocated */
+extern uint64_t scrollback_lines;
+extern uint64_t scrollback_used;
+extern uint64_t scrollback_allocated;
+extern uint64_t scrollback_evicted;
+
+/* History search: time per query, and bytes the trigram index takes */
+extern struct histogram search_latency;
+extern uint64_t search_index_bytes;
+
+/* Chat log: reopening it (replay included), writes, fdatasync()s, bytes logged */
+extern uint64_t chatlog_reload_ns;
+extern uint64_t chatlog_writes;
+extern uint64_t chatlog_syncs;
+extern uint64_t chatlog_bytes;
+
+/* Startup: when main() began, then how long after that the first frame
+   was drawn, the keyboard opened and the server answered (0 until they
+   do).  It's interactive once the keyboard and the server are both up */
+extern uint64_t startup_ns;
+extern uint64_t first_frame_ns;
+extern uint64_t keyboard_ready_ns;
+extern uint64_t server_ready_ns;
+extern uint64_t interactive_ns;
+/* USB keyboard lookups the cache file answered, and ones it got wrong */
+extern uint64_t keyboard_cache_hits;
+extern uint64_t keyboard_cache_misses;
+
+/* Main loop epoll wakeups, and those that only blinked the cursor */
+extern uint64_t loop_wakeups;
+extern uint64_t idle_wakeups;
+extern uint64_t loop_start_ns;
+
+extern uint64_t monotonicNs(void);
+extern void histRecord(struct histogram *h, uint64_t value);
+extern uint64_t histPercentile(const struct histogram *h, double percentile);
+extern void histPrint(FILE *fp, const char *name, const struct histogram *h);
+extern void metricsReport(FILE *fp);
+#endif
@@ -0,0 +1,193 @@
+/*
+ * msghist: bounded history of sent messages, optionally kept in a file
+ */
+#include "msghist.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+static void forgetOldest(struct msghist *h)
+{
+  h->oldest = (h->oldest + 1) % MSGHIST_MAX;
+  h->count--;
+}
+
+/*
+  Arena offset with len contiguous bytes free, forgetting the oldest
+  messages until there is one.  Goes back to the front of the arena
+  when the space left at its end is too short.
+*/
+static size_t reserve(struct msghist *h, size_t len)
+{
+  const struct msghist_entry *oldest;
+
+  for (;;)
+  {
+    if (h->count == 0)
+      return h->tail = 0;
+    oldest = &h->index[h->oldest];
+    if (h->count < MSGHIST_MAX)
+    {
+      if (oldest->off >= h->tail)
+      {
+        if (oldest->off - h->tail >= len)
+          return h->tail;
+      }
+      else if (MSGHIST_ARENA_SIZE - h->tail >= len)
+        return h->tail;
+      else
+      {
+        h->tail = 0;
+        continue;
+      }
+    }
+    forgetOldest(h);
+  }
+}
+
+/*
+  Add a message to the ring only.  One longer than a quarter of the
+  arena keeps only its start.
+*/
+static void remember(struct msghist *h, const char *text, size_t len)
+{
+  struct msghist_entry *entry;
+  size_t off;
+
+  if (len > MSGHIST_ARENA_SIZE / 4)
+    len = MSGHIST_ARENA_SIZE / 4;
+  off = reserve(h, len);
+  memcpy(h->arena + off, text, len);
+  entry = &h->index[(h->oldest + h->count) % MSGHIST_MAX];
+  entry->off = off;
+  entry->len = len;
+  h->tail = off + len;
+  h->count++;
+}
+
+/*
+  Append a message to the file as a line, with one write.
+*/
+static void appendLine(int fd, const char *text, size_t len)
+{
+  struct iovec iov[2] = {{(void *)text, len}, {"\n", 1}};
+
+  /* A line that doesn't make it only costs the next session's recall */
+  writev(fd, iov, 2);
+}
+
+/*
+  Read every line of the file into the ring through a read-only mapping.
+  Returns the file's size.
+*/
+static size_t load(struct msghist *h, int fd)
+{
+  struct stat st;
+  const char *map, *p, *end, *nl;
+
+  if (fstat(fd, &st) != 0 || st.st_size == 0)
+    return 0;
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED)
+    return 0;
+  end = map + st.st_size;
+  for (p = map; p < end; p = nl + 1)
+  {
+    if ((nl = memchr(p, '\n', end - p)) == NULL)
+      nl = end; /* Cut off by a crash mid-write */
+    if (nl > p)
+      remember(h, p, nl - p);
+  }
+  munmap((void *)map, st.st_size);
+  return st.st_size;
+}
+
+/*
+  The file only ever grows, so once it is well past what the ring keeps
+  it is replaced with just the remembered messages.  Returns the new
+  file's descriptor, or fd unchanged if it couldn't be rewritten.
+*/
+static int compact(struct msghist *h, const char *path, int fd)
+{
+  char tmp[PATH_MAX];
+  int out;
+
+  if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp) ||
+      (out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644)) < 0)
+    return fd;
+  for (size_t i = 0; i < h->count; i++)
+  {
+    const struct msghist_entry *entry = &h->index[(h->oldest + i) % MSGHIST_MAX];
+    appendLine(out, h->arena + entry->off, entry->len);
+  }
+  if (rename(tmp, path) != 0)
+  {
+    close(out);
+    unlink(tmp);
+    return fd;
+  }
+  close(fd);
+  return out;
+}
+
+/*
+ * Start with an empty history, or with the one in the file at path if
+ * not NULL (created if missing).  Returns 0 on success, -1 if the file
+ * couldn't be opened.
+ */
+int msgHistInit(struct msghist *h, const char *path)
+{
+  memset(h, 0, sizeof(*h));
+  h->fd = -1;
+  if (path == NULL)
+    return 0;
+  if ((h->fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) < 0)
+    return -1;
+  if (load(h, h->fd) > MSGHIST_FILE_MAX)
+    h->fd = compact(h, path, h->fd);
+  return 0;
+}
+
+/*
+ * Remember a sent message, and append it to the file.  Empty messages
+ * and repeats of the last one are left out.
+ */
+void msgHistAdd(struct msghist *h, const char *text, size_t len)
+{
+  size_t last_len;
+  const char *last = msgHistGet(h, 1, &last_len);
+
+  if (len == 0 || (last != NULL && last_len == len && memcmp(last, text, len) == 0))
+    return;
+  remember(h, text, len);
+  if (h->fd >= 0)
+    appendLine(h->fd, text, len);
+}
+
+/*
+ * The nth most recent message (1 is the last one sent) as one run of
+ * bytes in the arena, or NULL if there aren't that many.
+ */
+const char *msgHistGet(const struct msghist *h, size_t n, size_t *len)
+{
+  const struct msghist_entry *entry;
+
+  if (n == 0 || n > h->count)
+    return NULL;
+  entry = &h->index[(h->oldest + h->count - n) % MSGHIST_MAX];
+  *len = entry->len;
+  return h->arena + entry->off;
+}
+
+void msgHistClose(struct msghist *h)
+{
+  if (h->fd >= 0)
+    close(h->fd);
+  h->fd = -1;
+}
@@ -0,0 +1,42 @@
+#ifndef _MSGHIST_H
+#define _MSGHIST_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MSGHIST_MAX 256                        /* Messages remembered */
+#define MSGHIST_ARENA_SIZE (64 * 1024)         /* Bytes of text remembered */
+#define MSGHIST_FILE_MAX (4 * MSGHIST_ARENA_SIZE) /* Longer files are rewritten at startup */
+
+/* Where one message's text sits in the arena */
+struct msghist_entry
+{
+  uint32_t off;
+  uint32_t len;
+};
+
+/*
+ * Messages sent, for Up/Down to recall, oldest forgotten first.  The text
+ * goes end to end into one arena, but unlike the scrollback a message
+ * never wraps around its end: it starts over at the front instead, so
+ * every message is one run of bytes that can be copied out in one go.
+ * A ring of msghist_entry records indexes it.
+ *
+ * With a file, every message is also appended to it as a line, and the
+ * lines already there are loaded at startup.
+ */
+struct msghist
+{
+  char arena[MSGHIST_ARENA_SIZE];
+  size_t tail;   /* Arena offset for the next message */
+  struct msghist_entry index[MSGHIST_MAX];
+  size_t oldest; /* Index slot of the oldest message */
+  size_t count;
+  int fd;        /* History file, or -1 */
+};
+
+extern int msgHistInit(struct msghist *h, const char *path);
+extern void msgHistAdd(struct msghist *h, const char *text, size_t len);
+extern const char *msgHistGet(const struct msghist *h, size_t n, size_t *len);
+extern void msgHistClose(struct msghist *h);
+#endif
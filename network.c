@@ -0,0 +1,684 @@
+/*
+ * network: non-blocking chat server connection for the main epoll loop
+ *
+ * References:
+ *
+ * http://beej.us/guide/bgnet/output/html/singlepage/bgnet.html
+ * man 7 epoll
+ * man 7 tcp (keepalive, TCP_USER_TIMEOUT)
+ * man 3 io_uring_prep_recv_multishot, io_uring_prep_send
+ */
+#include "network.h"
+#include "metrics.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+/* Ring requests carry what they are in the low bits of user_data and
+   the socket generation they were made for above that */
+#define OP_RECV 1
+#define OP_SEND 2
+#define OP_BITS 8
+#define OP_MASK ((1 << OP_BITS) - 1)
+
+static void updateInterest(struct netconn *conn)
+{
+  bool want = conn->out_count > 0;
+  struct epoll_event ev = {
+      .events = EPOLLIN | EPOLLRDHUP | (want ? EPOLLOUT : 0),
+      .data.fd = conn->fd,
+  };
+
+  if (want == conn->want_write)
+    return;
+  epoll_ctl(conn->epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+  conn->want_write = want;
+}
+
+/*
+  n more bytes went out: retire the messages they finish.
+*/
+static void consumed(struct netconn *conn, size_t n)
+{
+  uint64_t now = monotonicNs();
+
+  send_bytes += n;
+  while (n > 0)
+  {
+    struct out_msg *msg = &conn->outq[conn->out_head];
+    size_t left = msg->len - msg->sent;
+    if (n < left)
+    {
+      msg->sent += n;
+      break;
+    }
+    n -= left;
+    histRecord(&send_latency, now - msg->queued_ns);
+    send_messages++;
+    conn->out_head = (conn->out_head + 1) % NET_MAX_PENDING;
+    conn->out_count--;
+  }
+  sendq_depth = conn->out_count;
+}
+
+static uint64_t tag(const struct netconn *conn, unsigned op)
+{
+  return (uint64_t)conn->generation << OP_BITS | op;
+}
+
+/*
+  Hand whatever was prepared to the kernel, counted against sending if
+  it includes sends and against receiving if it only re-arms.
+*/
+static int submitRing(struct netconn *conn, unsigned sends)
+{
+  if (conn->ring.sq_pending == 0)
+    return 0;
+  if (sends > 0)
+    send_syscalls++;
+  else
+    recv_syscalls++;
+  return uringSubmit(&conn->ring);
+}
+
+/*
+  Queue a multishot receive on the socket: it keeps completing, one
+  provided buffer per chunk, until the buffers run out or the socket
+  closes.  Goes to the kernel with the next submitRing().
+*/
+static void armRecv(struct netconn *conn)
+{
+  struct io_uring_sqe *sqe = uringGetSqe(&conn->ring);
+
+  if (sqe == NULL)
+    return; /* Tried again after the next completions */
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = conn->fd;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = URING_BUF_GROUP;
+  sqe->user_data = tag(conn, OP_RECV);
+  conn->recv_armed = true;
+}
+
+/*
+  Submit up to NET_MAX_IOV queued messages as one chain of linked
+  sends, unless the previous chain is still going.  MSG_WAITALL has the
+  kernel finish each one before the next starts; if one still comes up
+  short the rest of the chain is cancelled and sent again from there.
+*/
+static int submitSends(struct netconn *conn)
+{
+  struct io_uring_sqe *sqe, *last = NULL;
+  unsigned count = 0;
+
+  while (conn->in_flight == 0 && count < conn->out_count && count < NET_MAX_IOV &&
+         (sqe = uringGetSqe(&conn->ring)) != NULL)
+  {
+    struct out_msg *msg = &conn->outq[(conn->out_head + count) % NET_MAX_PENDING];
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = conn->fd;
+    sqe->addr = (uintptr_t)(msg->data + msg->sent);
+    sqe->len = msg->len - msg->sent;
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->user_data = tag(conn, OP_SEND);
+    last = sqe;
+    count++;
+  }
+  if (last != NULL)
+    last->flags &= ~IOSQE_IO_LINK;
+  conn->in_flight += count;
+  return submitRing(conn, count);
+}
+
+/*
+  Write as much of the queue as the socket takes right now, up to
+  NET_MAX_IOV messages per sendmsg().  MSG_MORE is set only while
+  messages remain behind the current batch, so the kernel may merge it
+  with the next call; the last batch goes without it and, with Nagle
+  off, is on the wire at once.  Returns -1 if the connection is broken.
+*/
+static int flush(struct netconn *conn)
+{
+  struct iovec iov[NET_MAX_IOV];
+  struct msghdr mh;
+  unsigned count;
+  ssize_t n;
+
+  if (conn->backend == NET_URING)
+    return submitSends(conn);
+  while (conn->out_count > 0)
+  {
+    count = conn->out_count < NET_MAX_IOV ? conn->out_count : NET_MAX_IOV;
+    for (unsigned i = 0; i < count; i++)
+    {
+      struct out_msg *msg = &conn->outq[(conn->out_head + i) % NET_MAX_PENDING];
+      iov[i].iov_base = msg->data + msg->sent;
+      iov[i].iov_len = msg->len - msg->sent;
+    }
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = iov;
+    mh.msg_iovlen = count;
+    n = sendmsg(conn->fd, &mh,
+                MSG_NOSIGNAL | (conn->out_count > count ? MSG_MORE : 0));
+    send_syscalls++;
+    if (n > 0)
+      consumed(conn, n);
+    else if (n < 0 && errno == EINTR)
+      continue;
+    else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      break; /* Short write: the rest goes on EPOLLOUT */
+    else
+      return -1;
+  }
+  updateInterest(conn);
+  return 0;
+}
+
+/*
+  Socket options for a live connection: no Nagle (netFlush() already
+  batches), and keepalive plus TCP_USER_TIMEOUT so a dead peer is
+  noticed within about NET_DEAD_MS whether or not we're sending.
+*/
+static int tuneSocket(int fd)
+{
+  int one = 1;
+  int idle = NET_KEEPALIVE_IDLE_S, intvl = NET_KEEPALIVE_INTVL_S, cnt = NET_KEEPALIVE_COUNT;
+  unsigned timeout = NET_DEAD_MS;
+
+  if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0 ||
+      setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one)) < 0 ||
+      setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle)) < 0 ||
+      setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &intvl, sizeof(intvl)) < 0 ||
+      setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &cnt, sizeof(cnt)) < 0 ||
+      setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &timeout, sizeof(timeout)) < 0)
+    return -1;
+  return 0;
+}
+
+/*
+  Have retry_tfd fire once, ms from now, or never if ms is 0.
+*/
+static void armRetry(struct netconn *conn, unsigned ms)
+{
+  struct itimerspec its = {
+      .it_value = {.tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000L},
+  };
+
+  timerfd_settime(conn->retry_tfd, 0, &its, NULL);
+}
+
+/*
+  Try again after the current backoff, give or take: the wait is drawn
+  from the upper half of it so clients dropped together don't all come
+  back at once.  Then double it, up to NET_BACKOFF_MAX_MS.
+*/
+static void scheduleRetry(struct netconn *conn)
+{
+  unsigned half = conn->backoff_ms / 2;
+  unsigned delay = half + rand_r(&conn->seed) % (half + 1);
+
+  armRetry(conn, delay);
+  conn->state = NET_WAITING;
+  conn->backoff_ms *= 2;
+  if (conn->backoff_ms > NET_BACKOFF_MAX_MS)
+    conn->backoff_ms = NET_BACKOFF_MAX_MS;
+}
+
+/*
+  Give up on a socket that never connected and wait for the next try.
+*/
+static void connectFailed(struct netconn *conn)
+{
+  epoll_ctl(conn->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+  close(conn->fd);
+  conn->fd = -1;
+  scheduleRetry(conn);
+}
+
+/*
+  Drop the socket and start waiting to reconnect.  Queued messages stay;
+  one that was half written is sent again whole on the new connection.
+  That is on purpose: the kernel taking the first part says nothing of
+  whether the server got it, and a server that splits lines per
+  connection throws away the unfinished one.  One that doesn't sees the
+  start of the message twice.
+*/
+static void lost(struct netconn *conn)
+{
+  if (conn->backend == NET_URING)
+  {
+    /* Ends the receive and any sends still running; whatever they
+       complete with is for an old generation now */
+    shutdown(conn->fd, SHUT_RDWR);
+    conn->generation++;
+    conn->in_flight = 0;
+    conn->recv_armed = false;
+    conn->flush_held = false;
+  }
+  conn->want_write = false;
+  framerResume(&conn->framer, conn->receive, NULL); /* Lines held back still count */
+  framerInit(&conn->framer);
+  if (conn->out_count > 0)
+    conn->outq[conn->out_head].sent = 0;
+  connections_lost++;
+  conn->down_since_ns = monotonicNs();
+  connectFailed(conn);
+}
+
+/*
+  The connection is up, for the first time or again: reset the backoff
+  and send everything that was queued while offline.
+*/
+static enum net_event connected(struct netconn *conn)
+{
+  struct epoll_event ev = {.events = EPOLLIN | EPOLLRDHUP, .data.fd = conn->fd};
+  bool first = conn->down_since_ns == 0; /* Never lost, so never up before */
+
+  armRetry(conn, 0); /* Connect deadline */
+  tuneSocket(conn->fd);
+  if (conn->backend == NET_URING)
+  {
+    /* From here on the ring does the socket's I/O */
+    epoll_ctl(conn->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    armRecv(conn);
+  }
+  else
+    epoll_ctl(conn->epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+  conn->want_write = false;
+  conn->state = NET_UP;
+  conn->backoff_ms = NET_BACKOFF_MIN_MS;
+  if (!first)
+    histRecord(&reconnect_latency, monotonicNs() - conn->down_since_ns);
+  if (flush(conn) < 0)
+  {
+    lost(conn);
+    return NET_NONE;
+  }
+  return first ? NET_CONNECTED : NET_RECONNECTED;
+}
+
+/*
+  Start a non-blocking connect; epoll reports writable when it's done,
+  even if it finished here already.  retry_tfd is its deadline: an
+  unreachable server that drops the SYNs would otherwise hold it up for
+  the kernel's two minutes of retries, whatever the backoff says.
+*/
+static void startConnect(struct netconn *conn)
+{
+  struct epoll_event ev = {.events = EPOLLOUT};
+
+  connect_attempts++;
+  conn->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (conn->fd < 0)
+  {
+    scheduleRetry(conn);
+    return;
+  }
+  ev.data.fd = conn->fd;
+  epoll_ctl(conn->epfd, EPOLL_CTL_ADD, conn->fd, &ev);
+  conn->state = NET_CONNECTING;
+  armRetry(conn, NET_CONNECT_MS);
+  if (connect(conn->fd, (struct sockaddr *)&conn->addr, sizeof(conn->addr)) < 0 &&
+      errno != EINPROGRESS)
+    connectFailed(conn);
+}
+
+/*
+  Go through what the ring completed.  Received chunks are copied into
+  the framer and their buffers handed straight back; finished sends
+  retire their messages.  Completions for an earlier socket only give
+  back their buffers.  Then the receive is re-armed if it ran out of
+  buffers, and a flush held up by the last chain of sends goes now that
+  it's done.
+*/
+static enum net_event reap(struct netconn *conn)
+{
+  enum net_event event = NET_NONE;
+  struct io_uring_cqe *cqe;
+  size_t space;
+
+  /* Anything left past NET_MAX_CQES, or behind a backlog of lines,
+     keeps the ring fd readable */
+  framerResume(&conn->framer, conn->receive, conn->yield);
+  for (int reaped = 0; reaped < NET_MAX_CQES && !framerBacklog(&conn->framer) &&
+                       (cqe = uringPeek(&conn->ring)) != NULL;
+       reaped++)
+  {
+    uint64_t data = cqe->user_data;
+    int res = cqe->res;
+    unsigned flags = cqe->flags;
+    bool current = conn->state == NET_UP && data >> OP_BITS == conn->generation;
+
+    uringSeen(&conn->ring);
+    if (flags & IORING_CQE_F_BUFFER)
+    {
+      unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+      if (current && res > 0)
+      {
+        recv_bytes += res;
+        memcpy(framerSpace(&conn->framer, &space), uringBuffer(&conn->ring, bid), res);
+        framerCommit(&conn->framer, res, conn->receive, conn->yield);
+        if (framerBacklog(&conn->framer))
+          recv_preempted++;
+      }
+      uringRecycle(&conn->ring, bid);
+    }
+    if (!current)
+      continue;
+    if ((data & OP_MASK) == OP_RECV)
+    {
+      if (!(flags & IORING_CQE_F_MORE))
+        conn->recv_armed = false;
+      /* Out of buffers only pauses it; EOF or an error ends the connection */
+      if (res == 0 || (res < 0 && res != -ENOBUFS))
+      {
+        framerFinish(&conn->framer, conn->receive);
+        lost(conn);
+        event = NET_LOST;
+      }
+    }
+    else
+    {
+      conn->in_flight--;
+      if (res > 0)
+        consumed(conn, res);
+      else if (res != -ECANCELED)
+      {
+        lost(conn);
+        event = NET_LOST;
+      }
+    }
+  }
+  if (conn->state != NET_UP)
+    return event;
+  if (!conn->recv_armed)
+    armRecv(conn);
+  if (conn->flush_held && conn->in_flight == 0)
+  {
+    conn->flush_held = false;
+    if (flush(conn) < 0)
+    {
+      lost(conn);
+      return NET_LOST;
+    }
+  }
+  else if (submitRing(conn, 0) < 0)
+  {
+    lost(conn);
+    return NET_LOST;
+  }
+  return event;
+}
+
+/*
+ * Start connecting to addr in the background and return at once.  The
+ * socket and the timerfd that paces retries go in the epoll set (the
+ * caller dispatches conn->retry_tfd to netHandleTimer()), and
+ * netHandleEvents() reports NET_CONNECTED when the server answers.
+ * Until then failed attempts are retried with the same backoff as after
+ * a drop, and messages can already be queued.  Each complete line
+ * received is passed to receive; if yield (which may be NULL) says so
+ * between two of them, the rest are held back for netResume().  With
+ * backend NET_URING the ring fd goes in the set as well and takes over
+ * from the socket once it's connected; if io_uring isn't available this
+ * falls back to NET_EPOLL, and conn->backend says which is in use.
+ * Returns 0 on success, -1 if the setup failed.
+ */
+int netConnect(struct netconn *conn, int epfd, const struct sockaddr_in *addr,
+               enum net_backend backend, line_f receive, yield_f yield)
+{
+  struct epoll_event ev = {.events = EPOLLIN};
+
+  memset(conn, 0, sizeof(*conn));
+  framerInit(&conn->framer);
+  conn->fd = -1;
+  conn->epfd = epfd;
+  conn->addr = *addr;
+  conn->receive = receive;
+  conn->yield = yield;
+  conn->backoff_ms = NET_BACKOFF_MIN_MS;
+  conn->seed = (unsigned)monotonicNs() ^ (unsigned)getpid();
+  if ((conn->retry_tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+    return -1;
+  ev.data.fd = conn->retry_tfd;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, conn->retry_tfd, &ev) < 0)
+    return -1;
+  if (backend == NET_URING && uringInit(&conn->ring) == 0)
+  {
+    conn->backend = NET_URING;
+    ev.data.fd = conn->ring.fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, conn->ring.fd, &ev) < 0)
+      return -1;
+  }
+  startConnect(conn);
+  return 0;
+}
+
+/*
+ * Whether epoll events for fd belong to netHandleEvents(): the socket,
+ * or with io_uring the ring.
+ */
+bool netOwnsFd(const struct netconn *conn, int fd)
+{
+  return fd == conn->fd || (conn->backend == NET_URING && fd == conn->ring.fd);
+}
+
+/*
+ * Whether received lines are being held back because yield asked.
+ * They don't wake epoll by themselves: the caller keeps calling
+ * netResume() until this is false.
+ */
+bool netBacklog(const struct netconn *conn)
+{
+  return framerBacklog(&conn->framer);
+}
+
+/*
+ * Hand out received lines held back by yield, until it asks again.
+ */
+void netResume(struct netconn *conn)
+{
+  framerResume(&conn->framer, conn->receive, conn->yield);
+}
+
+/*
+ * Handle what epoll reported for fd: finish a pending connect, or read
+ * what's available, pass each complete line on and push out
+ * queued data if it's writable.  With io_uring, collect what the ring
+ * completed instead.  A broken connection is closed here and a
+ * reconnect scheduled; the return value says if that happened, or if
+ * the link just came back.
+ */
+enum net_event netHandleEvents(struct netconn *conn, int fd, uint32_t events)
+{
+  size_t space;
+  char *buf;
+  ssize_t n;
+  int err = 0;
+  socklen_t errlen = sizeof(err);
+
+  if (conn->backend == NET_URING && fd == conn->ring.fd)
+    return reap(conn);
+  if (conn->state == NET_CONNECTING)
+  {
+    getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &err, &errlen);
+    if (err == 0 && !(events & (EPOLLERR | EPOLLHUP)))
+      return connected(conn);
+    connectFailed(conn);
+    return NET_NONE;
+  }
+  if (conn->backend == NET_URING)
+    return NET_NONE; /* The socket is only in the epoll set while connecting */
+
+  if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+  {
+    /* Lines held back last time go first, and nothing more is read
+       until they have.  Anything left past NET_MAX_READS, or unread
+       behind a backlog, wakes epoll again at once. */
+    framerResume(&conn->framer, conn->receive, conn->yield);
+    for (int reads = 0; reads < NET_MAX_READS && !framerBacklog(&conn->framer); reads++)
+    {
+      buf = framerSpace(&conn->framer, &space);
+      n = read(conn->fd, buf, space);
+      recv_syscalls++;
+      if (n > 0)
+      {
+        recv_bytes += n;
+        framerCommit(&conn->framer, n, conn->receive, conn->yield);
+        if (framerBacklog(&conn->framer))
+        {
+          recv_preempted++;
+          break;
+        }
+        /* Socket was drained; epoll says if more arrives */
+        if ((size_t)n < space)
+          break;
+      }
+      else if (n < 0 && errno == EINTR)
+        continue;
+      else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        break;
+      else
+      {
+        framerFinish(&conn->framer, conn->receive);
+        lost(conn); /* EOF or error */
+        return NET_LOST;
+      }
+    }
+  }
+  if ((events & EPOLLOUT) && flush(conn) < 0)
+  {
+    lost(conn);
+    return NET_LOST;
+  }
+  return NET_NONE;
+}
+
+/*
+ * The reconnect timer fired: try connecting again, or give up on a
+ * connect that has taken NET_CONNECT_MS and wait to try again.
+ */
+enum net_event netHandleTimer(struct netconn *conn)
+{
+  uint64_t expirations;
+
+  if (read(conn->retry_tfd, &expirations, sizeof(expirations)) < 0)
+    return NET_NONE;
+  if (conn->state == NET_WAITING)
+    startConnect(conn);
+  else if (conn->state == NET_CONNECTING)
+  {
+    connect_timeouts++;
+    connectFailed(conn);
+  }
+  return NET_NONE;
+}
+
+/*
+ * Queue a copy of text with a newline added.  Nothing is written until
+ * netFlush(), and while the server is unreachable messages wait here
+ * for the reconnect.  Delivery is at least once: a message cut off by
+ * a dropped connection is sent again whole, so the server may have had
+ * a fragment of it first.  Returns false (and drops the message) if the
+ * queue is full or the text is too long.
+ */
+bool netSendLine(struct netconn *conn, const char *text, size_t len)
+{
+  struct out_msg *msg;
+
+  if (conn->state == NET_CLOSED || conn->out_count == NET_MAX_PENDING ||
+      len >= NET_MSG_SIZE)
+  {
+    send_dropped++;
+    return false;
+  }
+  msg = &conn->outq[(conn->out_head + conn->out_count) % NET_MAX_PENDING];
+  memcpy(msg->data, text, len);
+  msg->data[len] = '\n';
+  msg->len = len + 1;
+  msg->sent = 0;
+  msg->queued_ns = monotonicNs();
+  conn->out_count++;
+  sendq_depth = conn->out_count;
+  if (sendq_depth > sendq_depth_max)
+    sendq_depth_max = sendq_depth;
+  return true;
+}
+
+/*
+ * Write whatever was queued since the last call.  If the socket is
+ * already backed up EPOLLOUT takes care of it instead (with io_uring,
+ * the completion of the sends in flight), and while offline the
+ * reconnect does.  Returns NET_LOST if the write found the
+ * connection broken.
+ */
+enum net_event netFlush(struct netconn *conn)
+{
+  /* The chain in flight may be done by now, and finding out is only a
+     look at the completion ring; if so the next one goes at once,
+     otherwise when its completion comes in */
+  if (conn->backend == NET_URING && conn->in_flight > 0)
+  {
+    conn->flush_held = true;
+    return reap(conn);
+  }
+  if (conn->state != NET_UP || conn->out_count == 0 || conn->want_write)
+    return NET_NONE;
+  if (flush(conn) < 0)
+  {
+    lost(conn);
+    return NET_LOST;
+  }
+  return NET_NONE;
+}
+
+/*
+ * How many more messages netSendLine() will take right now, so a caller
+ * splitting one message into several lines can check they all fit
+ * before queueing any of them.
+ */
+unsigned netRoom(const struct netconn *conn)
+{
+  return conn->state == NET_CLOSED ? 0 : NET_MAX_PENDING - conn->out_count;
+}
+
+/*
+ * Whether the queue should go now even though more messages may be on
+ * the way: what isn't already in flight fills a whole batch, or its
+ * oldest message has waited NET_BATCH_NS.
+ */
+bool netBatchDue(const struct netconn *conn)
+{
+  unsigned waiting = conn->out_count - conn->in_flight;
+  unsigned oldest = (conn->out_head + conn->in_flight) % NET_MAX_PENDING;
+
+  return waiting >= NET_MAX_IOV ||
+         (waiting > 0 && monotonicNs() - conn->outq[oldest].queued_ns >= NET_BATCH_NS);
+}
+
+void netClose(struct netconn *conn)
+{
+  if (conn->state == NET_CLOSED)
+    return;
+  if (conn->fd >= 0)
+  {
+    epoll_ctl(conn->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    conn->fd = -1;
+  }
+  epoll_ctl(conn->epfd, EPOLL_CTL_DEL, conn->retry_tfd, NULL);
+  close(conn->retry_tfd);
+  if (conn->backend == NET_URING)
+    uringExit(&conn->ring); /* Cancels whatever is still in flight */
+  conn->state = NET_CLOSED;
+}
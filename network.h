@@ -0,0 +1,116 @@
+#ifndef _NETWORK_H
+#define _NETWORK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <netinet/in.h>
+#include "framer.h"
+#include "uring.h"
+
+#define NET_MSG_SIZE 256     /* Longest message, newline included */
+#define NET_MAX_LINE (NET_MSG_SIZE - 1) /* Longest text netSendLine() takes */
+#define NET_MAX_PENDING 256  /* Messages waiting to go to the server */
+#define NET_MAX_IOV 64       /* Messages handed to one sendmsg() or send chain */
+#define NET_BATCH_NS 1000000 /* Longest a message waits for others to join it */
+#define NET_MAX_READS 16     /* Per wakeup, so a flood can't starve the keyboard */
+#define NET_MAX_CQES 64      /* The same 1 MiB cap in io_uring receive buffers */
+
+#define NET_KEEPALIVE_IDLE_S 10  /* Quiet this long before the first probe */
+#define NET_KEEPALIVE_INTVL_S 5  /* Between unanswered probes */
+#define NET_KEEPALIVE_COUNT 3    /* Unanswered probes before giving up */
+#define NET_DEAD_MS 15000        /* Unacknowledged data this long means dead */
+#define NET_CONNECT_MS 5000      /* A connect() not done by then has failed */
+#define NET_BACKOFF_MIN_MS 250   /* First reconnect waits about this long */
+#define NET_BACKOFF_MAX_MS 30000 /* and it doubles up to this */
+
+/* A queued message: the queue's own copy, how much of it went out, and when it was queued */
+struct out_msg
+{
+  char data[NET_MSG_SIZE];
+  size_t len;
+  size_t sent;
+  uint64_t queued_ns;
+};
+
+enum net_state
+{
+  NET_CLOSED,     /* Not started, or netClose() called */
+  NET_UP,
+  NET_WAITING,    /* Lost or refused; retry_tfd fires when it's time to try again */
+  NET_CONNECTING, /* Non-blocking connect() in progress; retry_tfd is its deadline */
+};
+
+/* How socket I/O is done once connected */
+enum net_backend
+{
+  NET_EPOLL, /* read() and sendmsg() when epoll says the socket is ready */
+  NET_URING, /* Multishot receive and linked sends through io_uring */
+};
+
+/* What a call into the connection did that the user should hear about */
+enum net_event
+{
+  NET_NONE,
+  NET_CONNECTED, /* Up for the first time */
+  NET_LOST,
+  NET_RECONNECTED,
+};
+
+/*
+ * Non-blocking connection to the chat server, driven from the main
+ * loop's epoll set.  Nothing here ever blocks: netSendLine() only
+ * queues, and netFlush() at the end of each loop pass writes everything
+ * queued during it with as few sendmsg() calls as will take it.  Once
+ * the socket fills up the rest drains as it reports writable.
+ *
+ * With the io_uring backend the socket itself leaves the epoll set
+ * once connected and the ring fd takes its place.  A single multishot
+ * receive delivers data into provided buffers without a system call
+ * per chunk, and each flush submits the queue as a chain of linked
+ * sends, which the kernel runs in order, with one io_uring_enter().
+ * Only one chain is in flight at a time so a later one can't overtake
+ * it; messages queued meanwhile go when it completes.
+ *
+ * The first connect already happens in the background.  If it fails, or
+ * the connection later drops, it is retried with jittered exponential
+ * backoff; messages typed meanwhile wait in the same queue and go out
+ * when it's up.
+ */
+struct netconn
+{
+  int fd; /* -1 while waiting to try again */
+  int epfd;
+  int retry_tfd;
+  enum net_state state;
+  struct sockaddr_in addr;
+  unsigned backoff_ms;
+  unsigned seed; /* For the backoff jitter */
+  uint64_t down_since_ns;
+  bool want_write; /* EPOLLOUT is armed */
+  enum net_backend backend;
+  struct uring ring;    /* NET_URING only */
+  unsigned generation;  /* Tags requests so completions for a dropped socket are ignored */
+  unsigned in_flight;   /* Sends submitted and not yet completed */
+  bool recv_armed;      /* Multishot receive outstanding */
+  bool flush_held;      /* netFlush() waited for the sends in flight */
+  struct out_msg outq[NET_MAX_PENDING];
+  unsigned out_head, out_count;
+  struct line_framer framer; /* Received data not yet split into lines */
+  line_f receive;
+  yield_f yield; /* Asked between received lines whether to hold the rest back */
+};
+
+extern int netConnect(struct netconn *conn, int epfd, const struct sockaddr_in *addr,
+                      enum net_backend backend, line_f receive, yield_f yield);
+extern bool netOwnsFd(const struct netconn *conn, int fd);
+extern bool netBacklog(const struct netconn *conn);
+extern void netResume(struct netconn *conn);
+extern enum net_event netHandleEvents(struct netconn *conn, int fd, uint32_t events);
+extern enum net_event netHandleTimer(struct netconn *conn);
+extern bool netSendLine(struct netconn *conn, const char *text, size_t len);
+extern unsigned netRoom(const struct netconn *conn);
+extern enum net_event netFlush(struct netconn *conn);
+extern bool netBatchDue(const struct netconn *conn);
+extern void netClose(struct netconn *conn);
+#endif
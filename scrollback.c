@@ -0,0 +1,230 @@
+/*
+ * scrollback: bounded store of lines received from the server
+ */
+#include "scrollback.h"
+#include "wrap.h"
+#include "metrics.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+  Allocate cap bytes for the arena and index, cap being brought within
+  SCROLLBACK_MIN_BYTES .. SCROLLBACK_MAX_BYTES.  Returns 0 on success,
+  -1 if out of memory.
+*/
+int scrollbackInit(struct scrollback *sb, size_t cap)
+{
+  memset(sb, 0, sizeof(*sb));
+  if (cap < SCROLLBACK_MIN_BYTES)
+    cap = SCROLLBACK_MIN_BYTES;
+  if (cap > SCROLLBACK_MAX_BYTES)
+    cap = SCROLLBACK_MAX_BYTES;
+  /* Split the cap between text, index and row breaks (room for one per
+     line on average) so that, together, they use it all */
+  sb->max_lines = cap / (SCROLLBACK_AVG_LINE + sizeof(*sb->index) + sizeof(*sb->breaks));
+  sb->max_breaks = sb->max_lines;
+  sb->cap = cap - sb->max_lines * sizeof(*sb->index) - sb->max_breaks * sizeof(*sb->breaks);
+  sb->arena = malloc(sb->cap);
+  sb->index = malloc(sb->max_lines * sizeof(*sb->index));
+  sb->breaks = malloc(sb->max_breaks * sizeof(*sb->breaks));
+  if (sb->arena == NULL || sb->index == NULL || sb->breaks == NULL)
+  {
+    scrollbackFree(sb);
+    return -1;
+  }
+  scrollback_allocated = scrollbackMemory(sb);
+  return 0;
+}
+
+static void evictOldest(struct scrollback *sb)
+{
+  struct sb_line *line = &sb->index[sb->oldest];
+
+  sb->head = (sb->head + line->len) % sb->cap;
+  sb->used -= line->len;
+  sb->breaks_head = (sb->breaks_head + line->rows - 1) % sb->max_breaks;
+  sb->breaks_used -= line->rows - 1;
+  sb->oldest = (sb->oldest + 1) % sb->max_lines;
+  sb->count--;
+  sb->first++;
+  scrollback_evicted++;
+}
+
+/*
+  Word-wrap line n, whose text is s, recording where each of its rows
+  after the first starts.  Older lines are dropped if the breaks ring
+  fills; should this one alone fill it, its last row is cut short.
+*/
+static void layoutLine(struct scrollback *sb, uint64_t n, struct sb_line *line, const char *s)
+{
+  uint64_t start_ns = monotonicNs();
+  size_t start = 0, end;
+
+  line->brk = (sb->breaks_head + sb->breaks_used) % sb->max_breaks;
+  line->rows = 1;
+  if (sb->width == 0)
+    return;
+  while ((start = wrapRow(s, line->len, start, sb->width, &end)) < line->len)
+  {
+    while (sb->breaks_used == sb->max_breaks && sb->first < n)
+      evictOldest(sb);
+    if (sb->breaks_used == sb->max_breaks)
+      break;
+    sb->breaks[(line->brk + line->rows - 1) % sb->max_breaks] = start;
+    sb->breaks_used++;
+    line->rows++;
+  }
+  layout_lines++;
+  layout_rows += line->rows;
+  layout_ns += monotonicNs() - start_ns;
+}
+
+/*
+  Add a line, dropping the oldest ones until it fits.  A line longer
+  than a quarter of the arena keeps only its start.
+*/
+void scrollbackAppend(struct scrollback *sb, const char *s, size_t len)
+{
+  struct sb_line *line;
+  size_t tail, first_part;
+
+  if (len > sb->cap / 4)
+    len = sb->cap / 4;
+  while (sb->count > 0 && (sb->used + len > sb->cap || sb->count == sb->max_lines))
+    evictOldest(sb);
+
+  tail = (sb->head + sb->used) % sb->cap;
+  first_part = sb->cap - tail < len ? sb->cap - tail : len;
+  memcpy(sb->arena + tail, s, first_part);
+  memcpy(sb->arena, s + first_part, len - first_part);
+
+  line = &sb->index[(sb->oldest + sb->count) % sb->max_lines];
+  line->off = tail;
+  line->len = len;
+  layoutLine(sb, scrollbackEnd(sb), line, s);
+  sb->used += len;
+  sb->count++;
+  scrollback_lines = sb->count;
+  scrollback_used = sb->used + sb->count * sizeof(*line) + sb->breaks_used * sizeof(*sb->breaks);
+}
+
+static const struct sb_line *findLine(const struct scrollback *sb, uint64_t n)
+{
+  if (n < sb->first || n >= sb->first + sb->count)
+    return NULL;
+  return &sb->index[(sb->oldest + (n - sb->first)) % sb->max_lines];
+}
+
+/*
+  Length of line n, or 0 if it's gone (or never came).
+*/
+size_t scrollbackLength(const struct scrollback *sb, uint64_t n)
+{
+  const struct sb_line *line = findLine(sb, n);
+  return line ? line->len : 0;
+}
+
+/*
+ * Wrap lines to width columns from now on (0 for not at all).  Lines
+ * already stored are laid out again, but only if the width changed.
+ */
+void scrollbackSetWidth(struct scrollback *sb, size_t width)
+{
+  char *text;
+
+  if (width == sb->width)
+    return;
+  sb->width = width;
+  sb->breaks_head = sb->breaks_used = 0;
+  if (sb->count == 0)
+    return;
+  text = malloc(sb->cap / 4); /* The longest a line can be */
+  if (text == NULL)
+    sb->width = 0;
+  for (uint64_t n = sb->first; n < scrollbackEnd(sb); n++)
+  {
+    struct sb_line *line = &sb->index[(sb->oldest + (n - sb->first)) % sb->max_lines];
+    if (text != NULL)
+      scrollbackGet(sb, n, 0, text, line->len);
+    layoutLine(sb, n, line, text);
+  }
+  free(text);
+}
+
+/*
+  Screen rows line n takes; a line that is gone takes one, like an
+  empty one.
+*/
+unsigned scrollbackRows(const struct scrollback *sb, uint64_t n)
+{
+  const struct sb_line *line = findLine(sb, n);
+  return line ? line->rows : 1;
+}
+
+/*
+ * Where row r of line n starts in it; its text ends at *end, no more
+ * than a row's width further on.  Both are 0 for a row that isn't there.
+ */
+size_t scrollbackRowSpan(const struct scrollback *sb, uint64_t n, unsigned r, size_t *end)
+{
+  const struct sb_line *line = findLine(sb, n);
+  size_t start;
+
+  if (line == NULL || r >= line->rows)
+  {
+    *end = 0;
+    return 0;
+  }
+  start = r == 0 ? 0 : sb->breaks[(line->brk + r - 1) % sb->max_breaks];
+  *end = r + 1 < line->rows ? sb->breaks[(line->brk + r) % sb->max_breaks] : line->len;
+  if (sb->width && *end - start > sb->width)
+    *end = start + sb->width;
+  return start;
+}
+
+/*
+  Copy up to size bytes of line n, starting from byte from, into buf;
+  returns how many.
+*/
+size_t scrollbackGet(const struct scrollback *sb, uint64_t n, size_t from, char *buf, size_t size)
+{
+  const struct sb_line *line = findLine(sb, n);
+  size_t off, len, first_part;
+
+  if (line == NULL || from >= line->len)
+    return 0;
+  off = (line->off + from) % sb->cap;
+  len = line->len - from < size ? line->len - from : size;
+  first_part = sb->cap - off < len ? sb->cap - off : len;
+  memcpy(buf, sb->arena + off, first_part);
+  memcpy(buf + first_part, sb->arena, len - first_part);
+  return len;
+}
+
+/*
+  Number the next line will get; the newest stored is one less.
+*/
+uint64_t scrollbackEnd(const struct scrollback *sb)
+{
+  return sb->first + sb->count;
+}
+
+/*
+  Bytes allocated for the arena and index.
+*/
+size_t scrollbackMemory(const struct scrollback *sb)
+{
+  return sb->cap + sb->max_lines * sizeof(*sb->index) + sb->max_breaks * sizeof(*sb->breaks);
+}
+
+void scrollbackFree(struct scrollback *sb)
+{
+  free(sb->arena);
+  free(sb->index);
+  free(sb->breaks);
+  sb->arena = NULL;
+  sb->index = NULL;
+  sb->breaks = NULL;
+  sb->count = 0;
+}
@@ -0,0 +1,61 @@
+#ifndef _SCROLLBACK_H
+#define _SCROLLBACK_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SCROLLBACK_DEFAULT_BYTES (4 * 1024 * 1024)
+#define SCROLLBACK_MIN_BYTES (64 * 1024)
+#define SCROLLBACK_MAX_BYTES (1024 * 1024 * 1024) /* Arena offsets must fit sb_line's 32 bits */
+#define SCROLLBACK_AVG_LINE 32 /* Index is sized for lines this long on average */
+
+/* Where one line's text sits in the arena, and where its row breaks are */
+struct sb_line
+{
+  uint32_t off;
+  uint32_t len;
+  uint32_t brk;  /* Breaks ring slot of where its second row starts */
+  uint32_t rows; /* Screen rows it wraps to; rows - 1 breaks */
+};
+
+/*
+ * Received lines, oldest evicted first once the byte cap is reached.
+ * Text goes end to end into one arena used as a byte ring (a line may
+ * wrap around its end), and a ring of sb_line records indexes it.
+ * Lines are numbered from 0 as they arrive; the store holds numbers
+ * first .. first + count - 1.
+ *
+ * Each line is also word-wrapped once, as it comes in, for the width
+ * set with scrollbackSetWidth(): the offsets where its rows after the
+ * first start go into a ring of their own, in line order, so they are
+ * evicted along with the line.  Showing a line again just walks them.
+ */
+struct scrollback
+{
+  char *arena;
+  size_t cap;       /* Arena bytes; the index takes the rest of the cap */
+  size_t head;      /* Arena offset of the oldest line */
+  size_t used;      /* Arena bytes holding lines */
+  struct sb_line *index;
+  size_t max_lines; /* Index entries */
+  size_t oldest;    /* Index slot of the oldest line */
+  size_t count;
+  uint64_t first;   /* Number of the oldest line */
+  uint32_t *breaks;
+  size_t max_breaks;
+  size_t breaks_head; /* Slot of the oldest line's first break */
+  size_t breaks_used;
+  size_t width;       /* Columns the breaks are for, 0 for no wrapping */
+};
+
+extern int scrollbackInit(struct scrollback *sb, size_t cap);
+extern void scrollbackAppend(struct scrollback *sb, const char *s, size_t len);
+extern size_t scrollbackGet(const struct scrollback *sb, uint64_t n, size_t from, char *buf, size_t size);
+extern size_t scrollbackLength(const struct scrollback *sb, uint64_t n);
+extern void scrollbackSetWidth(struct scrollback *sb, size_t width);
+extern unsigned scrollbackRows(const struct scrollback *sb, uint64_t n);
+extern size_t scrollbackRowSpan(const struct scrollback *sb, uint64_t n, unsigned r, size_t *end);
+extern uint64_t scrollbackEnd(const struct scrollback *sb);
+extern size_t scrollbackMemory(const struct scrollback *sb);
+extern void scrollbackFree(struct scrollback *sb);
+#endif
@@ -0,0 +1,207 @@
+/*
+ * search: trigram index for finding received lines that hold a string
+ */
+#include "search.h"
+#include "metrics.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+static unsigned char fold(char c)
+{
+  return tolower((unsigned char)c);
+}
+
+/*
+  Bucket of the trigram at s, case folded.
+*/
+static unsigned bucketOf(const char *s)
+{
+  uint32_t t = (uint32_t)fold(s[0]) << 16 | (uint32_t)fold(s[1]) << 8 | fold(s[2]);
+  return (t * 2654435761u) >> 16 & (SEARCH_BUCKETS - 1);
+}
+
+/*
+  Index of the first line in p numbered n or more.
+*/
+static uint32_t lowerBound(const struct search_posting *p, uint32_t n)
+{
+  uint32_t lo = 0, hi = p->len;
+
+  while (lo < hi)
+  {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (p->lines[mid] < n)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/*
+  Make room for one more line in p: first by dropping lines that have
+  left the scrollback, otherwise by doubling it.  Returns false if out
+  of memory.
+*/
+static bool roomFor(struct search_posting *p, uint64_t first)
+{
+  uint32_t gone, cap;
+  uint32_t *lines;
+
+  if (p->len < p->cap)
+    return true;
+  gone = lowerBound(p, (uint32_t)first);
+  if (gone > 0)
+  {
+    memmove(p->lines, p->lines + gone, (p->len - gone) * sizeof(*p->lines));
+    p->len -= gone;
+    return true;
+  }
+  cap = p->cap ? p->cap * 2 : 4;
+  if ((lines = realloc(p->lines, cap * sizeof(*lines))) == NULL)
+    return false;
+  search_index_bytes += (cap - p->cap) * sizeof(*lines);
+  p->lines = lines;
+  p->cap = cap;
+  return true;
+}
+
+void searchIndexInit(struct search_index *idx)
+{
+  memset(idx, 0, sizeof(*idx));
+  search_index_bytes = sizeof(idx->buckets);
+}
+
+/*
+ * Add line n of the scrollback, whose text is s, to the index.  Lines
+ * must be added in the order they were numbered.
+ */
+void searchIndexLine(struct search_index *idx, const struct scrollback *sb, uint64_t n,
+                     const char *s, size_t len)
+{
+  for (size_t i = 0; i + 3 <= len; i++)
+  {
+    struct search_posting *p = &idx->buckets[bucketOf(s + i)];
+
+    if (p->len > 0 && p->lines[p->len - 1] == (uint32_t)n)
+      continue; /* Already there from earlier in this line */
+    if (!roomFor(p, sb->first))
+      return;
+    p->lines[p->len++] = (uint32_t)n;
+  }
+}
+
+/*
+ * Where q first occurs in s, ignoring case, or NULL.
+ */
+const char *searchMatch(const char *s, size_t len, const char *q, size_t qlen)
+{
+  size_t j;
+
+  for (size_t i = 0; qlen > 0 && i + qlen <= len; i++)
+  {
+    for (j = 0; j < qlen && fold(s[i + j]) == fold(q[j]); j++)
+      ;
+    if (j == qlen)
+      return s + i;
+  }
+  return NULL;
+}
+
+/*
+  Read line n back and check that it really holds q.
+*/
+static bool lineHas(struct search_index *idx, const struct scrollback *sb, uint64_t n,
+                    const char *q, size_t qlen)
+{
+  size_t len = scrollbackLength(sb, n);
+  char *scratch;
+
+  if (len > idx->scratch_size)
+  {
+    if ((scratch = realloc(idx->scratch, len)) == NULL)
+      return false;
+    idx->scratch = scratch;
+    idx->scratch_size = len;
+  }
+  len = scrollbackGet(sb, n, 0, idx->scratch, len);
+  return searchMatch(idx->scratch, len, q, qlen) != NULL;
+}
+
+static bool inList(const struct search_posting *p, uint32_t n)
+{
+  uint32_t i = lowerBound(p, n);
+  return i < p->len && p->lines[i] == n;
+}
+
+/*
+ * The nearest line to from holding q, going back (older) or forward
+ * from it; from itself isn't looked at, so scrollbackEnd() finds the
+ * newest.  Queries shorter than a trigram read every line on the way.
+ * Returns false if there is none.
+ */
+bool searchFind(struct search_index *idx, const struct scrollback *sb, const char *q,
+                size_t qlen, uint64_t from, bool older, uint64_t *hit)
+{
+  const struct search_posting *lists[SEARCH_MAX_QUERY], *shortest = NULL;
+  uint64_t start = monotonicNs(), end = scrollbackEnd(sb), n;
+  size_t count = 0;
+  bool found = false;
+  uint32_t i;
+
+  if (qlen == 0 || qlen > SEARCH_MAX_QUERY || sb->count == 0)
+    return false;
+  if (qlen < 3)
+  {
+    n = from < sb->first ? sb->first - 1 : from;
+    while (!found && (older ? n-- > sb->first : ++n < end))
+      found = lineHas(idx, sb, n, q, qlen);
+  }
+  else
+  {
+    for (size_t k = 0; k + 3 <= qlen; k++)
+    {
+      lists[count] = &idx->buckets[bucketOf(q + k)];
+      if (shortest == NULL || lists[count]->len < shortest->len)
+        shortest = lists[count];
+      count++;
+    }
+    i = lowerBound(shortest, (uint32_t)(older ? from : from + 1));
+    n = 0;
+    while (!found)
+    {
+      if (older ? i == 0 : i == shortest->len)
+        break;
+      n = older ? shortest->lines[--i] : shortest->lines[i++];
+      if (n < sb->first)
+      {
+        if (older)
+          break; /* All the rest are gone too */
+        continue;
+      }
+      found = true;
+      for (size_t k = 0; k < count && found; k++)
+        found = lists[k] == shortest || inList(lists[k], n);
+      found = found && lineHas(idx, sb, n, q, qlen);
+    }
+  }
+  if (found)
+    *hit = n;
+  histRecord(&search_latency, monotonicNs() - start);
+  return found;
+}
+
+void searchIndexFree(struct search_index *idx)
+{
+  for (size_t b = 0; b < SEARCH_BUCKETS; b++)
+  {
+    free(idx->buckets[b].lines);
+    idx->buckets[b].lines = NULL;
+    idx->buckets[b].len = idx->buckets[b].cap = 0;
+  }
+  free(idx->scratch);
+  idx->scratch = NULL;
+  idx->scratch_size = 0;
+}
@@ -0,0 +1,47 @@
+#ifndef _SEARCH_H
+#define _SEARCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "scrollback.h"
+
+#define SEARCH_BUCKETS (1 << 16) /* Power of two */
+#define SEARCH_MAX_QUERY 64
+
+/* Lines holding a trigram that hashes to one bucket, oldest first */
+struct search_posting
+{
+  uint32_t *lines;
+  uint32_t len, cap;
+};
+
+/*
+ * Trigram index over the scrollback, for finding which lines hold a
+ * string without reading them all.  Each line adds its number to the
+ * posting list of every trigram in it (case folded) as it arrives, so
+ * lists stay sorted and adding costs one append per trigram.  A query
+ * walks the shortest list of its trigrams, checks the others with a
+ * binary search, and only reads the lines left to confirm them.
+ *
+ * Trigrams are hashed into a fixed number of buckets rather than kept
+ * exactly: two sharing a bucket only means more lines to confirm.
+ * Lines the scrollback has evicted are dropped from the front of a
+ * list when it next needs to grow.  Line numbers are kept in 32 bits,
+ * which lasts for four billion lines.
+ */
+struct search_index
+{
+  struct search_posting buckets[SEARCH_BUCKETS];
+  char *scratch; /* A line read back to confirm it */
+  size_t scratch_size;
+};
+
+extern void searchIndexInit(struct search_index *idx);
+extern void searchIndexLine(struct search_index *idx, const struct scrollback *sb, uint64_t n,
+                            const char *s, size_t len);
+extern bool searchFind(struct search_index *idx, const struct scrollback *sb, const char *q,
+                       size_t qlen, uint64_t from, bool older, uint64_t *hit);
+extern const char *searchMatch(const char *s, size_t len, const char *q, size_t qlen);
+extern void searchIndexFree(struct search_index *idx);
+#endif
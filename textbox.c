@@ -0,0 +1,342 @@
+/*
+ * textbox: layout and batched drawing of the received-text area
+ */
+#include "textbox.h"
+#include "wrap.h"
+#include "metrics.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define ALL_ROWS ((uint32_t)((1ULL << TEXT_BOX_ROWS) - 1))
+
+static char *screenRow(struct text_box *tb, unsigned row)
+{
+  return tb->rows[(tb->top + row) % TEXT_BOX_ROWS];
+}
+
+void textBoxInit(struct text_box *tb, struct scrollback *history)
+{
+  tb->history = history;
+  if (history)
+    scrollbackSetWidth(history, TEXT_BOX_COLS);
+  tb->paged = tb->page_dirty = false;
+  memset(tb->rows, ' ', sizeof(tb->rows));
+  tb->top = tb->row = tb->col = 0;
+  tb->scrolled = 0;
+  tb->dirty = 0;
+}
+
+/*
+  Start the next row, scrolling the top one off if the box is full.
+*/
+static void newRow(struct text_box *tb)
+{
+  text_rows_laid++;
+  tb->col = 0;
+  if (++tb->row < TEXT_BOX_ROWS)
+    return;
+  tb->row = TEXT_BOX_ROWS - 1;
+  tb->top = (tb->top + 1) % TEXT_BOX_ROWS;
+  memset(screenRow(tb, tb->row), ' ', TEXT_BOX_COLS);
+  tb->dirty = (tb->dirty >> 1) | (1u << tb->row);
+  tb->scrolled++;
+}
+
+/*
+  Put one row of text on the current row, then move to a fresh one.
+*/
+static void putRow(struct text_box *tb, const char *s, size_t len)
+{
+  memcpy(screenRow(tb, tb->row) + tb->col, s, len);
+  tb->dirty |= 1u << tb->row;
+  newRow(tb);
+}
+
+/*
+  Lay out one line: word-wrapped over as many rows as it needs, then
+  move to a fresh row.  The history store works out the breaks as it
+  takes the line and keeps them, so paging back to it later doesn't wrap
+  it again.
+*/
+void textBoxPutLine(struct text_box *tb, const char *s, size_t len)
+{
+  size_t start = 0, end;
+  unsigned rows;
+  uint64_t n;
+
+  if (tb->history == NULL)
+  {
+    do
+    {
+      size_t next = wrapRow(s, len, start, TEXT_BOX_COLS, &end);
+      putRow(tb, s + start, end - start);
+      start = next;
+    } while (start < len);
+    return;
+  }
+  n = scrollbackEnd(tb->history);
+  scrollbackAppend(tb->history, s, len);
+  rows = scrollbackRows(tb->history, n);
+  for (unsigned r = 0; r < rows; r++)
+  {
+    start = scrollbackRowSpan(tb->history, n, r, &end);
+    putRow(tb, s + start, end - start);
+  }
+}
+
+/*
+  Lay out a NUL-terminated string that may hold several lines.
+*/
+void textBoxPutString(struct text_box *tb, const char *s)
+{
+  const char *nl;
+
+  while ((nl = strchr(s, '\n')) != NULL)
+  {
+    textBoxPutLine(tb, s, nl - s);
+    s = nl + 1;
+  }
+  if (*s)
+  {
+    size_t len = strlen(s);
+    textBoxPutLine(tb, s, len);
+  }
+}
+
+/*
+  Number of the topmost line (maybe only partly) in a full window whose
+  bottom line is bottom.
+*/
+static uint64_t windowTop(struct text_box *tb, uint64_t bottom)
+{
+  unsigned rows = 0;
+  uint64_t n = bottom;
+
+  for (;;)
+  {
+    rows += scrollbackRows(tb->history, n);
+    if (rows >= TEXT_BOX_ROWS || n == tb->history->first)
+      return n;
+    n--;
+  }
+}
+
+/*
+  Go back a page.  The line at the top of the screen becomes the bottom
+  one, so a page always overlaps the last by a line.
+*/
+void textBoxPageUp(struct text_box *tb)
+{
+  uint64_t end, bottom, top;
+
+  if (tb->history == NULL || tb->history->count == 0)
+    return;
+  end = scrollbackEnd(tb->history);
+  bottom = tb->paged ? tb->page_bottom : end - 1;
+  top = windowTop(tb, bottom);
+  if (top == bottom && top > tb->history->first)
+    top--;
+  tb->page_bottom = top;
+  tb->paged = true;
+  tb->page_dirty = true;
+}
+
+/*
+  Go forward a page: the bottom line becomes the top one.  Paging past
+  the newest line goes back to the live view.
+*/
+void textBoxPageDown(struct text_box *tb)
+{
+  uint64_t end, n;
+  unsigned rows;
+
+  if (!tb->paged)
+    return;
+  end = scrollbackEnd(tb->history);
+  rows = scrollbackRows(tb->history, tb->page_bottom);
+  for (n = tb->page_bottom + 1; n < end; n++)
+  {
+    rows += scrollbackRows(tb->history, n);
+    if (rows > TEXT_BOX_ROWS)
+      break;
+  }
+  if (n >= end)
+  {
+    textBoxLive(tb);
+    return;
+  }
+  tb->page_bottom = n - 1 > tb->page_bottom ? n - 1 : n;
+  tb->page_dirty = true;
+}
+
+/*
+ * Show the history window with line n at its bottom.
+ */
+void textBoxShowLine(struct text_box *tb, uint64_t n)
+{
+  if (tb->history == NULL)
+    return;
+  tb->page_bottom = n;
+  tb->paged = true;
+  tb->page_dirty = true;
+}
+
+/*
+ * Leave the history window for the newest lines.
+ */
+void textBoxLive(struct text_box *tb)
+{
+  if (!tb->paged)
+    return;
+  /* The pixels are the history window, so redraw it all */
+  tb->paged = false;
+  tb->dirty = ALL_ROWS;
+  tb->scrolled = 0;
+  fbline('-', TEXT_BOX_END_ROWS);
+}
+
+/*
+ * Pick out every place s occurs (ignoring case) in the history window;
+ * a len of 0 stops it.
+ */
+void textBoxHighlight(struct text_box *tb, const char *s, size_t len)
+{
+  if (len > sizeof(tb->highlight))
+    len = sizeof(tb->highlight);
+  memcpy(tb->highlight, s, len);
+  tb->highlight_len = len;
+  tb->page_dirty = tb->paged;
+}
+
+/*
+  Which characters of the row [start, end) of line n are part of a
+  highlighted match; a match may run over from the row before or into
+  the next, so a little either side is read too.
+*/
+static void findHighlights(struct text_box *tb, uint64_t n, size_t start, size_t end,
+                           bool marked[TEXT_BOX_COLS])
+{
+  char text[TEXT_BOX_COLS + 2 * SEARCH_MAX_QUERY];
+  size_t qlen = tb->highlight_len;
+  size_t from = start >= qlen - 1 ? start - (qlen - 1) : 0;
+  size_t len = scrollbackGet(tb->history, n, from, text, end - from + qlen - 1);
+  const char *hit = text;
+
+  memset(marked, 0, TEXT_BOX_COLS);
+  while ((hit = searchMatch(hit, text + len - hit, tb->highlight, qlen)) != NULL)
+  {
+    for (size_t i = from + (hit - text); i < from + (hit - text) + qlen; i++)
+      if (i >= start && i < end)
+        marked[i - start] = true;
+    hit++;
+  }
+}
+
+/*
+  Draw the history window ending at page_bottom, filling the box from
+  the bottom row up, and say where it is on the separator line.
+*/
+static void renderPage(struct text_box *tb)
+{
+  char text[TEXT_BOX_COLS];
+  bool marked[TEXT_BOX_COLS];
+  char where[MAX_COLS + 1];
+  int row = TEXT_BOX_ROWS;
+  uint64_t n = tb->page_bottom;
+
+  if (n < tb->history->first)
+    n = tb->page_bottom = tb->history->first; /* Evicted while we looked */
+  while (row > 0)
+  {
+    unsigned need = scrollbackRows(tb->history, n);
+    unsigned shown = need < (unsigned)row ? need : (unsigned)row;
+
+    /* Only the tail of a line taller than what's left of the box fits */
+    row -= shown;
+    for (unsigned r = 0; r < shown; r++)
+    {
+      size_t end, start = scrollbackRowSpan(tb->history, n, need - shown + r, &end);
+      size_t len = scrollbackGet(tb->history, n, start, text, end - start);
+
+      memset(text + len, ' ', TEXT_BOX_COLS - len);
+      if (tb->highlight_len > 0)
+        findHighlights(tb, n, start, end, marked);
+      for (unsigned col = 0; col < TEXT_BOX_COLS; col++)
+      {
+        if (tb->highlight_len > 0 && marked[col])
+          fbputcharInverse(text[col], TEXT_BOX_START_ROWS + row + r, TEXT_BOX_START_COLS + col);
+        else
+          fbputchar(text[col], TEXT_BOX_START_ROWS + row + r, TEXT_BOX_START_COLS + col);
+      }
+      text_rows_drawn++;
+    }
+    if (n == tb->history->first)
+      break;
+    n--;
+  }
+  for (int r = 0; r < row; r++)
+    fbline(' ', TEXT_BOX_START_ROWS + r);
+
+  fbline('-', TEXT_BOX_END_ROWS);
+  if (tb->highlight_len > 0)
+    snprintf(where, sizeof(where), " found in %llu/%llu, ^R older, ^S newer ",
+             (unsigned long long)(tb->page_bottom + 1),
+             (unsigned long long)scrollbackEnd(tb->history));
+  else
+    snprintf(where, sizeof(where), " history %llu/%llu, PageDown for more ",
+             (unsigned long long)(tb->page_bottom + 1),
+             (unsigned long long)scrollbackEnd(tb->history));
+  fbputs(where, TEXT_BOX_END_ROWS, 2);
+  tb->page_dirty = false;
+}
+
+/*
+  Bring the screen up to date.  Whatever scrolled since last time is one
+  framebuffer move (or nothing, if it was a whole screen or more), then
+  only changed rows are drawn.  yield (if not NULL) is asked after each
+  row whether to stop there; the rows not drawn stay dirty, and scroll
+  with the rest if more lines come in before the next render.  A history
+  page is drawn whole.  Returns false if it stopped short.
+*/
+bool textBoxRender(struct text_box *tb, bool (*yield)(void))
+{
+  uint64_t start;
+
+  if (tb->paged)
+  {
+    /* Rows keep being laid out underneath; only the page is drawn */
+    if (tb->page_dirty || tb->page_bottom < tb->history->first)
+    {
+      start = monotonicNs();
+      renderPage(tb);
+      histRecord(&render_latency, monotonicNs() - start);
+    }
+    return true;
+  }
+  if (!tb->dirty)
+    return true;
+  start = monotonicNs();
+  if (tb->scrolled >= TEXT_BOX_ROWS)
+    tb->dirty = ALL_ROWS;
+  else if (tb->scrolled > 0)
+    fbScrollRows(TEXT_BOX_START_ROWS, TEXT_BOX_END_ROWS, tb->scrolled);
+  tb->scrolled = 0;
+  for (unsigned row = 0; row < TEXT_BOX_ROWS && tb->dirty; row++)
+  {
+    const char *text = screenRow(tb, row);
+    if (!(tb->dirty & (1u << row)))
+      continue;
+    for (unsigned col = 0; col < TEXT_BOX_COLS; col++)
+      fbputchar(text[col], TEXT_BOX_START_ROWS + row, TEXT_BOX_START_COLS + col);
+    tb->dirty &= ~(1u << row);
+    text_rows_drawn++;
+    if (tb->dirty && yield != NULL && yield())
+    {
+      render_preempted++;
+      break;
+    }
+  }
+  histRecord(&render_latency, monotonicNs() - start);
+  return tb->dirty == 0;
+}
@@ -0,0 +1,50 @@
+#ifndef _TEXTBOX_H
+#define _TEXTBOX_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "fbputchar.h"
+#include "scrollback.h"
+#include "search.h"
+
+#define TEXT_BOX_ROWS (TEXT_BOX_END_ROWS - TEXT_BOX_START_ROWS)
+#define TEXT_BOX_COLS (MAX_COLS - TEXT_BOX_START_COLS)
+
+/*
+ * What the received-text area should show, kept apart from the pixels.
+ * Lines are laid out into a ring of screen rows, which costs a memcpy,
+ * and nothing is drawn until textBoxRender().  However many lines came
+ * in since the last render, it draws at most one screen's worth: rows
+ * that scrolled off in between are never drawn at all.  Drawing can
+ * also stop between rows for something more urgent and carry on later.
+ *
+ * Every line also goes to the history store.  Paging back shows a
+ * window laid out straight from it, one screen redraw per page, while
+ * new lines keep arriving underneath.
+ */
+struct text_box
+{
+  char rows[TEXT_BOX_ROWS][TEXT_BOX_COLS]; /* Ring; rows[top] is the top screen row */
+  unsigned top;
+  unsigned row, col;  /* Where the next character goes, on screen */
+  unsigned scrolled;  /* Rows scrolled since the last render */
+  uint32_t dirty;     /* Screen rows changed since the last render, bit 0 = top */
+  struct scrollback *history;
+  bool paged;          /* Showing history instead of the live rows */
+  bool page_dirty;     /* The history window needs drawing */
+  uint64_t page_bottom; /* Number of the line at the bottom of the history window */
+  char highlight[SEARCH_MAX_QUERY]; /* Shown in reverse video in the history window */
+  size_t highlight_len;
+};
+
+extern void textBoxInit(struct text_box *tb, struct scrollback *history);
+extern void textBoxPutLine(struct text_box *tb, const char *s, size_t len);
+extern void textBoxPutString(struct text_box *tb, const char *s);
+extern void textBoxPageUp(struct text_box *tb);
+extern void textBoxPageDown(struct text_box *tb);
+extern void textBoxShowLine(struct text_box *tb, uint64_t n);
+extern void textBoxLive(struct text_box *tb);
+extern void textBoxHighlight(struct text_box *tb, const char *s, size_t len);
+extern bool textBoxRender(struct text_box *tb, bool (*yield)(void));
+#endif
@@ -0,0 +1,200 @@
+/*
+ * undo: undo/redo log of edits to the message being typed
+ */
+#include "undo.h"
+
+#include <string.h>
+
+void undoInit(struct undo_log *log)
+{
+  log->tail = 0;
+  log->oldest = 0;
+  log->count = 0;
+  log->done = 0;
+  log->group = 0;
+  log->sealed = true;
+}
+
+static struct undo_op *opAt(struct undo_log *log, size_t i)
+{
+  return &log->ops[(log->oldest + i) % UNDO_MAX_OPS];
+}
+
+/*
+  Whether len bytes at the arena tail are free of the oldest op's text.
+*/
+static bool roomAtTail(const struct undo_log *log, size_t len)
+{
+  const struct undo_op *oldest = &log->ops[log->oldest];
+
+  if (oldest->off >= log->tail)
+    return oldest->off - log->tail >= len;
+  return UNDO_ARENA_SIZE - log->tail >= len;
+}
+
+/*
+  Arena offset with len contiguous bytes free, forgetting the oldest
+  edits until there is one; as in msghist.c, going back to the front of
+  the arena when the space at its end is too short.
+*/
+static size_t reserve(struct undo_log *log, size_t len)
+{
+  for (;;)
+  {
+    if (log->count == 0)
+      return log->tail = 0;
+    if (log->count < UNDO_MAX_OPS)
+    {
+      if (roomAtTail(log, len))
+        return log->tail;
+      if (log->ops[log->oldest].off < log->tail)
+      {
+        log->tail = 0;
+        continue;
+      }
+    }
+    log->oldest = (log->oldest + 1) % UNDO_MAX_OPS;
+    log->count--;
+    log->done--;
+  }
+}
+
+/*
+  Whether an edit carries on from the last one, so they undo together.
+  Typing starts a new group at each word.
+*/
+static bool continues(struct undo_log *log, const struct undo_op *last, enum undo_kind kind,
+                      size_t pos, size_t removed_len, const char *inserted)
+{
+  if (log->sealed || last->kind != kind)
+    return false;
+  switch (kind)
+  {
+  case UNDO_TYPE:
+    return pos == last->pos + last->inserted &&
+           !(log->arena[last->off + last->removed + last->inserted - 1] == ' ' && *inserted != ' ');
+  case UNDO_OVERTYPE:
+    return pos == last->pos + last->inserted;
+  case UNDO_ERASE:
+    return pos + removed_len == last->pos;
+  }
+  return false;
+}
+
+/*
+ * Log an edit just made: at pos, removed_len characters (removed) were
+ * replaced by inserted_len others (inserted).  Anything undone and not
+ * yet redone is dropped.
+ */
+void undoRecord(struct undo_log *log, enum undo_kind kind, size_t pos,
+                const char *removed, size_t removed_len,
+                const char *inserted, size_t inserted_len)
+{
+  size_t len = removed_len + inserted_len, off;
+  struct undo_op *last = NULL, *op;
+  bool joins = false;
+
+  log->count = log->done;
+  if (log->count > 0)
+  {
+    last = opAt(log, log->count - 1);
+    log->tail = last->off + last->removed + last->inserted;
+    joins = continues(log, last, kind, pos, removed_len, inserted);
+  }
+  if (len > UNDO_ARENA_SIZE / 4)
+  {
+    /* Too big to keep: what came before can't be undone past it either */
+    undoInit(log);
+    return;
+  }
+
+  /* More typing straight after the last: grow its inserted text */
+  if (joins && kind == UNDO_TYPE && removed_len == 0 && roomAtTail(log, inserted_len))
+  {
+    memcpy(log->arena + log->tail, inserted, inserted_len);
+    last->inserted += inserted_len;
+    log->tail += inserted_len;
+    return;
+  }
+
+  off = reserve(log, len); /* May forget the oldest, moving the slots along */
+  op = opAt(log, log->count);
+  op->off = off;
+  if (removed_len > 0)
+    memcpy(log->arena + op->off, removed, removed_len);
+  if (inserted_len > 0)
+    memcpy(log->arena + op->off + removed_len, inserted, inserted_len);
+  op->pos = pos;
+  op->removed = removed_len;
+  op->inserted = inserted_len;
+  op->kind = kind;
+  op->group = joins ? log->group : ++log->group;
+  log->tail = op->off + len;
+  log->count++;
+  log->done = log->count;
+  log->sealed = false;
+}
+
+/*
+  Grow changed to cover r.
+*/
+static void widen(struct gap_range *changed, const struct gap_range *r)
+{
+  if (r->from < changed->from)
+    changed->from = r->from;
+  if (r->to > changed->to)
+    changed->to = r->to;
+}
+
+/*
+ * Undo the last group of edits, newest first, leaving the cursor where
+ * it began.  Returns false if there is nothing to undo; otherwise
+ * changed says what to redraw.
+ */
+bool undoRevert(struct undo_log *log, struct gap_buffer *g, struct gap_range *changed)
+{
+  const struct undo_op *op;
+  struct gap_range r;
+  uint32_t group;
+
+  if (log->done == 0)
+    return false;
+  group = opAt(log, log->done - 1)->group;
+  changed->from = SIZE_MAX;
+  changed->to = 0;
+  while (log->done > 0 && (op = opAt(log, log->done - 1))->group == group)
+  {
+    gapSplice(g, op->pos, op->inserted, log->arena + op->off, op->removed, &r);
+    widen(changed, &r);
+    log->done--;
+  }
+  log->group = log->done ? opAt(log, log->done - 1)->group : 0;
+  log->sealed = true;
+  return true;
+}
+
+/*
+ * Redo the next group of undone edits, oldest first.  Returns false if
+ * there is nothing to redo.
+ */
+bool undoReapply(struct undo_log *log, struct gap_buffer *g, struct gap_range *changed)
+{
+  const struct undo_op *op;
+  struct gap_range r;
+  uint32_t group;
+
+  if (log->done == log->count)
+    return false;
+  group = opAt(log, log->done)->group;
+  changed->from = SIZE_MAX;
+  changed->to = 0;
+  while (log->done < log->count && (op = opAt(log, log->done))->group == group)
+  {
+    gapSplice(g, op->pos, op->removed, log->arena + op->off + op->removed, op->inserted, &r);
+    widen(changed, &r);
+    log->done++;
+  }
+  log->group = group;
+  log->sealed = true;
+  return true;
+}
@@ -0,0 +1,62 @@
+#ifndef _UNDO_H
+#define _UNDO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "gapbuf.h"
+
+#define UNDO_MAX_OPS 512            /* Edits remembered */
+#define UNDO_ARENA_SIZE (16 * 1024) /* Bytes of text they can hold between them */
+
+/* How an edit was made, so a run of the same kind undoes as one */
+enum undo_kind
+{
+  UNDO_TYPE,     /* Characters inserted */
+  UNDO_ERASE,    /* Backspace */
+  UNDO_OVERTYPE, /* Characters typed over others */
+};
+
+/*
+ * One edit: at pos, removed characters were replaced by inserted ones.
+ * Both texts sit in the arena at off, the removed text first.
+ */
+struct undo_op
+{
+  uint32_t pos;
+  uint32_t off;
+  uint32_t removed;
+  uint32_t inserted;
+  uint32_t group; /* Edits in the same group are undone together */
+  enum undo_kind kind;
+};
+
+/*
+ * Undo/redo log for the message being typed.  Rather than snapshots it
+ * keeps each edit as the range it changed plus the text that went and
+ * came, so undoing or redoing one costs as much as the edit did, and a
+ * run of typing adjacent characters grows one op instead of adding one
+ * per key.  Op texts go into a fixed arena the way sent messages do
+ * into the message history (never wrapping around its end), with a ring
+ * of undo_op records; once either fills, the oldest edits are forgotten.
+ *
+ * The first done ops have been applied, the rest were undone and can be
+ * redone until a new edit replaces them.
+ */
+struct undo_log
+{
+  char arena[UNDO_ARENA_SIZE];
+  size_t tail; /* Arena offset for the next op's text */
+  struct undo_op ops[UNDO_MAX_OPS];
+  size_t oldest, count, done;
+  uint32_t group; /* Of the newest op */
+  bool sealed;    /* The next edit starts a new group */
+};
+
+extern void undoInit(struct undo_log *log);
+extern void undoRecord(struct undo_log *log, enum undo_kind kind, size_t pos,
+                       const char *removed, size_t removed_len,
+                       const char *inserted, size_t inserted_len);
+extern bool undoRevert(struct undo_log *log, struct gap_buffer *g, struct gap_range *changed);
+extern bool undoReapply(struct undo_log *log, struct gap_buffer *g, struct gap_range *changed);
+#endif
@@ -0,0 +1,265 @@
+/*
+ * uring: minimal io_uring setup without liburing
+ *
+ * References:
+ *
+ * man 7 io_uring
+ * man 2 io_uring_setup, io_uring_enter, io_uring_register
+ * man 3 io_uring_register_buf_ring
+ */
+#include "uring.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+
+/*
+  The kernel reads the submission tail and writes the completion tail
+  from other contexts, so those go through acquire/release accesses.
+*/
+#define LOAD_ACQUIRE(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+/*
+  Give the kernel the buffer ring and fill it with every buffer.
+*/
+static int setupBuffers(struct uring *u)
+{
+  struct io_uring_buf_reg reg;
+  void *ring;
+
+  if (posix_memalign(&ring, sysconf(_SC_PAGESIZE),
+                     URING_BUF_COUNT * sizeof(struct io_uring_buf)) != 0)
+    return -1;
+  memset(ring, 0, URING_BUF_COUNT * sizeof(struct io_uring_buf));
+  u->buf_ring = ring;
+  if ((u->bufs = malloc((size_t)URING_BUF_COUNT * URING_BUF_SIZE)) == NULL)
+    return -1;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uintptr_t)ring;
+  reg.ring_entries = URING_BUF_COUNT;
+  reg.bgid = URING_BUF_GROUP;
+  if (syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    return -1;
+  for (unsigned bid = 0; bid < URING_BUF_COUNT; bid++)
+    uringRecycle(u, bid);
+  return 0;
+}
+
+/*
+  Wait for the next completion.  Returns NULL if waiting failed.
+*/
+static struct io_uring_cqe *waitCqe(struct uring *u)
+{
+  struct io_uring_cqe *cqe;
+
+  while ((cqe = uringPeek(u)) == NULL)
+    if (syscall(__NR_io_uring_enter, u->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 &&
+        errno != EINTR)
+      return NULL;
+  return cqe;
+}
+
+/*
+  Whether multishot receive works here.  It came in 6.0, but 5.19
+  already registers buffer rings, and there every such receive fails
+  with -EINVAL.  No feature flag tells them apart, so receive a byte
+  over a socket pair with one, then shut it down and wait for the
+  receive to end so the ring is left empty.
+*/
+static bool probeMultishot(struct uring *u)
+{
+  struct io_uring_sqe *sqe;
+  struct io_uring_cqe *cqe;
+  bool works = false, more = true;
+  int sv[2];
+
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0)
+    return false;
+  if (write(sv[1], "", 1) == 1 && (sqe = uringGetSqe(u)) != NULL)
+  {
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = sv[0];
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+    if (uringSubmit(u) < 0)
+      more = false;
+    while (more && (cqe = waitCqe(u)) != NULL)
+    {
+      if (cqe->flags & IORING_CQE_F_BUFFER)
+        uringRecycle(u, cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+      more = cqe->flags & IORING_CQE_F_MORE;
+      if (cqe->res == 1 && more)
+      {
+        works = true;
+        shutdown(sv[0], SHUT_RDWR);
+      }
+      uringSeen(u);
+    }
+  }
+  close(sv[0]);
+  close(sv[1]);
+  return works && !more; /* Still going means it can't be trusted to end */
+}
+
+/*
+ * Create the ring, map it and register the provided buffers.  Returns 0
+ * on success, -1 if this kernel can't do it (too old for multishot
+ * receive, or io_uring disabled) and the caller should stick with epoll.
+ */
+int uringInit(struct uring *u)
+{
+  struct io_uring_params p;
+  char *sq, *cq;
+
+  memset(u, 0, sizeof(*u));
+  memset(&p, 0, sizeof(p));
+  u->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+  if (u->fd < 0)
+    return -1;
+  /* These came with 5.4 and 5.7; probeMultishot() checks for 6.0 */
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_FAST_POLL))
+    goto fail;
+
+  u->sq_entries = p.sq_entries;
+  u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  u->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (u->cq_ring_size > u->sq_ring_size)
+    u->sq_ring_size = u->cq_ring_size;
+  u->cq_ring_size = u->sq_ring_size; /* One mapping serves both */
+  u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+  if (u->sq_ring == MAP_FAILED)
+  {
+    u->sq_ring = NULL;
+    goto fail;
+  }
+  u->cq_ring = u->sq_ring;
+  u->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+  if (u->sqes == MAP_FAILED)
+  {
+    u->sqes = NULL;
+    goto fail;
+  }
+
+  sq = u->sq_ring;
+  u->sq_head = (unsigned *)(sq + p.sq_off.head);
+  u->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+  u->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+  u->sq_array = (unsigned *)(sq + p.sq_off.array);
+  cq = u->cq_ring;
+  u->cq_head = (unsigned *)(cq + p.cq_off.head);
+  u->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+  u->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+  u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+  /* Slot i of the array always names SQE i; uringGetSqe() hands them out in order */
+  for (unsigned i = 0; i < p.sq_entries; i++)
+    u->sq_array[i] = i;
+
+  if (setupBuffers(u) == 0 && probeMultishot(u))
+    return 0;
+fail:
+  uringExit(u);
+  return -1;
+}
+
+/*
+ * Next free submission entry, zeroed, or NULL if the ring is full.  It
+ * reaches the kernel with the next uringSubmit().
+ */
+struct io_uring_sqe *uringGetSqe(struct uring *u)
+{
+  unsigned tail = *u->sq_tail + u->sq_pending;
+  struct io_uring_sqe *sqe;
+
+  if (tail - LOAD_ACQUIRE(u->sq_head) >= u->sq_entries)
+    return NULL;
+  sqe = &u->sqes[tail & *u->sq_mask];
+  memset(sqe, 0, sizeof(*sqe));
+  u->sq_pending++;
+  return sqe;
+}
+
+/*
+ * Hand every prepared entry to the kernel: one io_uring_enter() however
+ * many there are.  Returns -1 on failure.
+ */
+int uringSubmit(struct uring *u)
+{
+  unsigned count = u->sq_pending;
+  int n;
+
+  if (count == 0)
+    return 0;
+  STORE_RELEASE(u->sq_tail, *u->sq_tail + count);
+  u->sq_pending = 0;
+  do
+    n = syscall(__NR_io_uring_enter, u->fd, count, 0, 0, NULL, 0);
+  while (n < 0 && errno == EINTR);
+  return n < 0 ? -1 : 0;
+}
+
+/*
+ * Oldest completion not yet seen, or NULL.  Only reads shared memory.
+ */
+struct io_uring_cqe *uringPeek(struct uring *u)
+{
+  unsigned head = *u->cq_head;
+
+  if (head == LOAD_ACQUIRE(u->cq_tail))
+    return NULL;
+  return &u->cqes[head & *u->cq_mask];
+}
+
+/*
+ * Done with the completion uringPeek() returned; the kernel may reuse it.
+ */
+void uringSeen(struct uring *u)
+{
+  STORE_RELEASE(u->cq_head, *u->cq_head + 1);
+}
+
+/*
+ * The provided buffer a receive completion names in its flags.
+ */
+char *uringBuffer(struct uring *u, unsigned bid)
+{
+  return u->bufs + (size_t)bid * URING_BUF_SIZE;
+}
+
+/*
+ * Put a provided buffer back in the ring for the next receive.
+ */
+void uringRecycle(struct uring *u, unsigned bid)
+{
+  unsigned short tail = u->buf_ring->tail;
+  struct io_uring_buf *buf = &u->buf_ring->bufs[tail & (URING_BUF_COUNT - 1)];
+
+  buf->addr = (uintptr_t)uringBuffer(u, bid);
+  buf->len = URING_BUF_SIZE;
+  buf->bid = bid;
+  STORE_RELEASE(&u->buf_ring->tail, (unsigned short)(tail + 1));
+}
+
+/*
+ * Tear down the ring.  Closing it cancels whatever is still in flight.
+ */
+void uringExit(struct uring *u)
+{
+  if (u->sqes)
+    munmap(u->sqes, u->sq_entries * sizeof(struct io_uring_sqe));
+  if (u->sq_ring)
+    munmap(u->sq_ring, u->sq_ring_size);
+  if (u->fd >= 0)
+    close(u->fd);
+  free(u->buf_ring);
+  free(u->bufs);
+  memset(u, 0, sizeof(*u));
+  u->fd = -1;
+}
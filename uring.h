@@ -0,0 +1,51 @@
+#ifndef _URING_H
+#define _URING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <linux/io_uring.h>
+
+#define URING_ENTRIES 128          /* Submission queue slots */
+#define URING_BUF_COUNT 64         /* Provided receive buffers, a power of two */
+#define URING_BUF_SIZE (16 * 1024) /* Bytes in each */
+#define URING_BUF_GROUP 0
+
+/*
+ * Bare io_uring instance, set up with the raw system calls so there is
+ * no liburing to install on the board.  Besides the submission and
+ * completion rings it owns one group of provided buffers: a multishot
+ * receive picks a free one for each chunk it completes, and the buffer
+ * is handed back with uringRecycle() once the chunk has been used.
+ *
+ * The ring fd polls readable while completions are waiting, so it goes
+ * in the main loop's epoll set like any other descriptor.
+ */
+struct uring
+{
+  int fd;
+  /* Submission ring */
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  struct io_uring_sqe *sqes;
+  unsigned sq_entries;
+  unsigned sq_pending; /* Prepared but not yet handed to the kernel */
+  /* Completion ring */
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_cqe *cqes;
+  /* Mappings, for uringExit() */
+  void *sq_ring, *cq_ring;
+  size_t sq_ring_size, cq_ring_size;
+  /* Provided buffers */
+  struct io_uring_buf_ring *buf_ring;
+  char *bufs;
+};
+
+extern int uringInit(struct uring *u);
+extern struct io_uring_sqe *uringGetSqe(struct uring *u);
+extern int uringSubmit(struct uring *u);
+extern struct io_uring_cqe *uringPeek(struct uring *u);
+extern void uringSeen(struct uring *u);
+extern char *uringBuffer(struct uring *u, unsigned bid);
+extern void uringRecycle(struct uring *u, unsigned bid);
+extern void uringExit(struct uring *u);
+#endif
@@ -1,7 +1,11 @@
 #include "usbkeyboard.h"
+#include "metrics.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
 
 /* References on libusb 1.0 and the USB HID/keyboard protocol
  *
@@ -12,17 +16,166 @@
  */
 
 /*
- * Find and return a USB keyboard device or NULL if not found
- * The argument con
- *
+  Where a keyboard was found: which port it sits on, what it is, and
+  which interface and endpoint carry its reports.
+*/
+struct keyboard_id
+{
+  uint8_t bus;
+  uint8_t ports[USB_MAX_PORT_DEPTH];
+  int num_ports;
+  uint16_t vendor, product;
+  uint8_t interface, endpoint;
+};
+
+/*
+  Fill in the port and vendor/product part of id for dev.
+*/
+static void identify(libusb_device *dev, const struct libusb_device_descriptor *desc,
+                     struct keyboard_id *id)
+{
+  id->bus = libusb_get_bus_number(dev);
+  id->num_ports = libusb_get_port_numbers(dev, id->ports, USB_MAX_PORT_DEPTH);
+  if (id->num_ports < 0)
+    id->num_ports = 0;
+  id->vendor = desc->idVendor;
+  id->product = desc->idProduct;
+}
+
+/*
+  Look through dev's first configuration for an interface that speaks
+  the keyboard protocol, and note it and its endpoint in id.  Returns
+  true if there is one.  The descriptor is freed either way.
+*/
+static bool findKeyboardInterface(libusb_device *dev, struct keyboard_id *id)
+{
+  struct libusb_config_descriptor *config;
+  bool found = false;
+  uint8_t i, k;
+
+  if (libusb_get_config_descriptor(dev, 0, &config) != 0)
+    return false;
+  for (i = 0; i < config->bNumInterfaces && !found; i++)
+    for (k = 0; k < config->interface[i].num_altsetting && !found; k++)
+    {
+      const struct libusb_interface_descriptor *inter =
+          config->interface[i].altsetting + k;
+      if (inter->bInterfaceClass == LIBUSB_CLASS_HID &&
+          inter->bInterfaceProtocol == USB_HID_KEYBOARD_PROTOCOL)
+      {
+        id->interface = i;
+        id->endpoint = inter->endpoint[0].bEndpointAddress;
+        found = true;
+      }
+    }
+  libusb_free_config_descriptor(config);
+  return found;
+}
+
+/*
+  Open dev and claim its keyboard interface from the kernel driver.
+*/
+static struct libusb_device_handle *claimKeyboard(libusb_device *dev, const struct keyboard_id *id)
+{
+  struct libusb_device_handle *keyboard;
+  int r;
+
+  if ((r = libusb_open(dev, &keyboard)) != 0)
+  {
+    fprintf(stderr, "Error: libusb_open failed: %d\n", r);
+    exit(1);
+  }
+  if (libusb_kernel_driver_active(keyboard, id->interface))
+    libusb_detach_kernel_driver(keyboard, id->interface);
+  libusb_set_auto_detach_kernel_driver(keyboard, id->interface);
+  if ((r = libusb_claim_interface(keyboard, id->interface)) != 0)
+  {
+    fprintf(stderr, "Error: libusb_claim_interface failed: %d\n", r);
+    exit(1);
+  }
+  return keyboard;
+}
+
+/*
+  The cache is one line of text:
+  bus port.port... vendor:product interface endpoint
+*/
+static bool readCache(const char *path, struct keyboard_id *id)
+{
+  FILE *fp;
+  char ports[32], *p;
+  unsigned bus, vendor, product, interface, endpoint;
+  int n;
+
+  if (path == NULL || (fp = fopen(path, "r")) == NULL)
+    return false;
+  n = fscanf(fp, "%u %31s %x:%x %u %x", &bus, ports, &vendor, &product, &interface, &endpoint);
+  fclose(fp);
+  if (n != 6)
+    return false;
+  id->bus = bus;
+  id->vendor = vendor;
+  id->product = product;
+  id->interface = interface;
+  id->endpoint = endpoint;
+  id->num_ports = 0;
+  /* Port numbers start at 1; a lone 0 means the root hub itself */
+  for (p = ports; *p && id->num_ports < USB_MAX_PORT_DEPTH; p++)
+  {
+    unsigned long port = strtoul(p, &p, 10);
+    if (port != 0)
+      id->ports[id->num_ports++] = port;
+    if (*p != '.')
+      break;
+  }
+  return true;
+}
+
+/*
+  Written to a temporary file and renamed, so a crash can't leave half
+  a line behind.
+*/
+static void writeCache(const char *path, const struct keyboard_id *id)
+{
+  char tmp[PATH_MAX];
+  FILE *fp;
+
+  if (path == NULL || snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp) ||
+      (fp = fopen(tmp, "w")) == NULL)
+    return;
+  fprintf(fp, "%u ", id->bus);
+  for (int i = 0; i < id->num_ports; i++)
+    fprintf(fp, i ? ".%u" : "%u", id->ports[i]);
+  fprintf(fp, "%s %04x:%04x %u %02x\n", id->num_ports ? "" : "0", id->vendor, id->product,
+          id->interface, id->endpoint);
+  if (fclose(fp) != 0 || rename(tmp, path) != 0)
+    unlink(tmp);
+}
+
+static bool sameKeyboard(const struct keyboard_id *a, const struct keyboard_id *b)
+{
+  return a->bus == b->bus && a->num_ports == b->num_ports &&
+         memcmp(a->ports, b->ports, a->num_ports) == 0 &&
+         a->vendor == b->vendor && a->product == b->product &&
+         a->interface == b->interface && a->endpoint == b->endpoint;
+}
+
+/*
+ * Find and open a USB keyboard.  If cache_path names the keyboard used
+ * last time and the same device is still on the same port, only that
+ * device's configuration is read; otherwise every device is checked
+ * and the one found is written back to the cache.  The endpoint to read
+ * reports from is stored in *endpoint_address.  Returns NULL if no
+ * keyboard device was found.
  */
-struct libusb_device_handle *openkeyboard(uint8_t *endpoint_address)
+struct libusb_device_handle *openkeyboard(uint8_t *endpoint_address, const char *cache_path)
 {
   libusb_device **devs;
   struct libusb_device_handle *keyboard = NULL;
   struct libusb_device_descriptor desc;
+  struct keyboard_id cached, id;
+  bool have_cache;
   ssize_t num_devs, d;
-  uint8_t i, k;
 
   /* Start the library */
   if (libusb_init(NULL) < 0)
@@ -38,9 +191,34 @@ struct libusb_device_handle *openkeyboard(uint8_t *endpoint_address)
     exit(1);
   }
 
-  /* Look at each device, remembering the first HID device that speaks
-     the keyboard protocol */
+  /* The device on the cached port, if it's still the same keyboard */
+  have_cache = readCache(cache_path, &cached);
+  for (d = 0; have_cache && d < num_devs; d++)
+  {
+    libusb_device *dev = devs[d];
+    if (libusb_get_bus_number(dev) != cached.bus ||
+        libusb_get_device_descriptor(dev, &desc) < 0)
+      continue;
+    identify(dev, &desc, &id);
+    if (id.num_ports != cached.num_ports || memcmp(id.ports, cached.ports, id.num_ports) != 0)
+      continue;
+    if (desc.bDeviceClass == LIBUSB_CLASS_PER_INTERFACE &&
+        findKeyboardInterface(dev, &id) && sameKeyboard(&id, &cached))
+      keyboard = claimKeyboard(dev, &id);
+    break; /* Only one device sits on a port */
+  }
+  if (keyboard != NULL)
+  {
+    keyboard_cache_hits++;
+    *endpoint_address = id.endpoint;
+    libusb_free_device_list(devs, 1);
+    return keyboard;
+  }
+  if (have_cache)
+    keyboard_cache_misses++;
 
+  /* Look at each device, taking the first HID device that speaks the
+     keyboard protocol */
   for (d = 0; d < num_devs; d++)
   {
     libusb_device *dev = devs[d];
@@ -49,83 +227,26 @@ struct libusb_device_handle *openkeyboard(uint8_t *endpoint_address)
       fprintf(stderr, "Error: libusb_get_device_descriptor failed\n");
       exit(1);
     }
-
-    if (desc.bDeviceClass == LIBUSB_CLASS_PER_INTERFACE)
+    if (desc.bDeviceClass == LIBUSB_CLASS_PER_INTERFACE && findKeyboardInterface(dev, &id))
     {
-      struct libusb_config_descriptor *config;
-      libusb_get_config_descriptor(dev, 0, &config);
-      for (i = 0; i < config->bNumInterfaces; i++)
-        for (k = 0; k < config->interface[i].num_altsetting; k++)
-        {
-          const struct libusb_interface_descriptor *inter =
-              config->interface[i].altsetting + k;
-          if (inter->bInterfaceClass == LIBUSB_CLASS_HID &&
-              inter->bInterfaceProtocol == USB_HID_KEYBOARD_PROTOCOL)
-          {
-            int r;
-            if ((r = libusb_open(dev, &keyboard)) != 0)
-            {
-              fprintf(stderr, "Error: libusb_open failed: %d\n", r);
-              exit(1);
-            }
-            if (libusb_kernel_driver_active(keyboard, i))
-              libusb_detach_kernel_driver(keyboard, i);
-            libusb_set_auto_detach_kernel_driver(keyboard, i);
-            if ((r = libusb_claim_interface(keyboard, i)) != 0)
-            {
-              fprintf(stderr, "Error: libusb_claim_interface failed: %d\n", r);
-              exit(1);
-            }
-            *endpoint_address = inter->endpoint[0].bEndpointAddress;
-            goto found;
-          }
-        }
+      identify(dev, &desc, &id);
+      keyboard = claimKeyboard(dev, &id);
+      *endpoint_address = id.endpoint;
+      writeCache(cache_path, &id);
+      break;
     }
   }
 
-found:
   libusb_free_device_list(devs, 1);
-
   return keyboard;
 }
 
-void setSpecialKeys(struct usb_keyboard_packet *packet, struct special_keys *s_keys) {
-  if (USB_LEFT_ARROW_KEY_PRESSED(packet->keycode))
-    s_keys->left_arrow = true;
-  else
-    s_keys->left_arrow = false;
-  if (USB_RIGHT_ARROW_KEY_PRESSED(packet->keycode))
-    s_keys->right_arrow = true;
-  else
-    s_keys->right_arrow = false;
-  if (USB_UP_ARROW_KEY_PRESSED(packet->keycode))
-    s_keys->up_arrow = true;
-  else
-    s_keys->up_arrow = false;
-  if (USB_DOWN_ARROW_KEY_PRESSED(packet->keycode))
-    s_keys->down_arrow = true;
-  else
-    s_keys->down_arrow = false;
-  if (USB_BACKSPACE_PRESSED(packet->keycode))
-    s_keys->backspace_pressed = true;
-  else
-    s_keys->backspace_pressed = false;
-  if (USB_CAPS_LOCK_PRESSED(packet->keycode))
-    s_keys->caps_lock = !s_keys->caps_lock;
-  if (USB_INSERT_PRESSED(packet->keycode))
-    s_keys->insert = !s_keys->insert;
-}
-
-void getCharsFromPacket(struct usb_keyboard_packet *packet, char *keys) {
-  for (uint8_t i = 0; i < 6; i++) {
-    keys[i] = getCharFromKeyCode(packet->modifiers, packet->keycode[i]);
-  }
-}
-
 char getCharFromKeyCode(uint8_t modifier, uint8_t keycode)
 {
   if (keycode >= 0x04 && keycode <= 0x1d) {
-      if (USB_SHIFT_PRESSED(modifier)) {
+      if (USB_CTRL_PRESSED(modifier)) {
+          return 0x01 + (keycode - 0x04); /* Control character, Ctrl+Z is 0x1a */
+      } else if (USB_SHIFT_PRESSED(modifier)) {
           return 'A' + (keycode - 0x04);
       } else {
           return 'a' + (keycode - 0x04);
@@ -144,7 +265,6 @@ char getCharFromKeyCode(uint8_t modifier, uint8_t keycode)
           case 0x26: return '(';
           case 0x27: return ')';
           case 0x28: return '\n';
-          case 0x29: s_keys.escape_pressed = true; return 0;
           case 0x2b: return '\t';
           case 0x2c: return ' ';
           case 0x2d: return '_';
@@ -173,7 +293,6 @@ char getCharFromKeyCode(uint8_t modifier, uint8_t keycode)
           case 0x26: return '9';
           case 0x27: return '0';
           case 0x28: return '\n';
-          case 0x29: s_keys.escape_pressed = true; return 0;
           case 0x2b: return '\t';
           case 0x2c: return ' ';
           case 0x2d: return '-';
@@ -191,4 +310,4 @@ char getCharFromKeyCode(uint8_t modifier, uint8_t keycode)
       }
   }
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,167 @@
+/*
+ * vkbd: virtual keyboard for exercising the evdev input path
+ *
+ * Creates a keyboard through /dev/uinput and types its arguments (or
+ * stdin) into it, so lab2 -i evdev can be tested without hardware.
+ *
+ * Usage: vkbd [-d delay_ms] [-w wait_ms] [-e] [text ...]
+ *
+ * References:
+ *
+ * https://www.kernel.org/doc/html/latest/input/uinput.html
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/uinput.h>
+
+#define KEYMAP_SIZE 58
+
+/* Characters produced by Linux keycodes 0..57, without and with shift */
+static const char keymap[KEYMAP_SIZE] =
+    "\0\033"
+    "1234567890-="
+    "\b\t"
+    "qwertyuiop[]"
+    "\n\0"
+    "asdfghjkl;'`"
+    "\0\\"
+    "zxcvbnm,./"
+    "\0*\0 ";
+static const char keymap_shift[KEYMAP_SIZE] =
+    "\0\033"
+    "!@#$%^&*()_+"
+    "\b\t"
+    "QWERTYUIOP{}"
+    "\n\0"
+    "ASDFGHJKL:\"~"
+    "\0|"
+    "ZXCVBNM<>?"
+    "\0*\0 ";
+
+static int ufd;
+static int delay_ms = 20;
+
+static void emit(int type, int code, int value)
+{
+  struct input_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.type = type;
+  ev.code = code;
+  ev.value = value;
+  if (write(ufd, &ev, sizeof(ev)) != sizeof(ev))
+    perror("vkbd: write");
+}
+
+static void tap(int code, bool shift)
+{
+  if (shift)
+  {
+    emit(EV_KEY, KEY_LEFTSHIFT, 1);
+    emit(EV_SYN, SYN_REPORT, 0);
+  }
+  emit(EV_KEY, code, 1);
+  emit(EV_SYN, SYN_REPORT, 0);
+  emit(EV_KEY, code, 0);
+  emit(EV_SYN, SYN_REPORT, 0);
+  if (shift)
+  {
+    emit(EV_KEY, KEY_LEFTSHIFT, 0);
+    emit(EV_SYN, SYN_REPORT, 0);
+  }
+  if (delay_ms)
+    usleep(delay_ms * 1000);
+}
+
+static void typeChar(char c)
+{
+  for (int code = 1; code < KEYMAP_SIZE; code++)
+  {
+    if (keymap[code] == c)
+    {
+      tap(code, false);
+      return;
+    }
+    if (keymap_shift[code] == c)
+    {
+      tap(code, true);
+      return;
+    }
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  struct uinput_setup setup;
+  int opt, wait_ms = 1000;
+  bool send_escape = false;
+  int c;
+
+  while ((opt = getopt(argc, argv, "d:w:e")) != -1)
+  {
+    switch (opt)
+    {
+    case 'd':
+      delay_ms = atoi(optarg);
+      break;
+    case 'w':
+      wait_ms = atoi(optarg);
+      break;
+    case 'e':
+      send_escape = true;
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-d delay_ms] [-w wait_ms] [-e] [text ...]\n", argv[0]);
+      exit(1);
+    }
+  }
+
+  if ((ufd = open("/dev/uinput", O_WRONLY | O_NONBLOCK)) < 0)
+  {
+    perror("vkbd: /dev/uinput");
+    exit(1);
+  }
+  ioctl(ufd, UI_SET_EVBIT, EV_KEY);
+  for (int code = 1; code < KEYMAP_SIZE; code++)
+    ioctl(ufd, UI_SET_KEYBIT, code);
+
+  memset(&setup, 0, sizeof(setup));
+  setup.id.bustype = BUS_VIRTUAL;
+  setup.id.vendor = 0x4840;
+  setup.id.product = 0x0002;
+  strcpy(setup.name, "lab2 virtual keyboard");
+  if (ioctl(ufd, UI_DEV_SETUP, &setup) < 0 || ioctl(ufd, UI_DEV_CREATE) < 0)
+  {
+    perror("vkbd: uinput setup");
+    exit(1);
+  }
+  /* Give lab2 time to find and open the new event device */
+  usleep(wait_ms * 1000);
+
+  if (optind < argc)
+  {
+    for (int i = optind; i < argc; i++)
+    {
+      for (const char *s = argv[i]; *s; s++)
+        typeChar(*s);
+      if (i + 1 < argc)
+        typeChar(' ');
+    }
+  }
+  else
+  {
+    while ((c = getchar()) != EOF)
+      typeChar(c);
+  }
+  if (send_escape)
+    tap(KEY_ESC, false);
+
+  usleep(100 * 1000);
+  ioctl(ufd, UI_DEV_DESTROY);
+  close(ufd);
+  return 0;
+}
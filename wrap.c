@@ -0,0 +1,32 @@
+/*
+ * wrap: where a line of received text breaks into screen rows
+ */
+#include "wrap.h"
+
+/*
+ * The row of s[0 .. len) starting at start, at most width characters:
+ * its text ends at *end.  Returns where the next row starts, len if this
+ * is the last.
+ */
+size_t wrapRow(const char *s, size_t len, size_t start, size_t width, size_t *end)
+{
+  size_t limit = start + width;
+
+  if (len - start <= width)
+  {
+    *end = len;
+    return len;
+  }
+  /* s[limit] is the first character that doesn't fit: a space there
+     still lets the row fill up */
+  for (size_t i = limit; i > start; i--)
+  {
+    if (s[i] == ' ')
+    {
+      *end = i;
+      return i + 1;
+    }
+  }
+  *end = limit;
+  return limit;
+}
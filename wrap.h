@@ -0,0 +1,13 @@
+#ifndef _WRAP_H
+#define _WRAP_H
+
+#include <stddef.h>
+
+/*
+ * Word wrap.  A line is cut into rows at the last space that fits, the
+ * space itself going nowhere; only a word longer than a whole row is cut
+ * in the middle.  Rows are found one at a time from where the last one
+ * ended, so the caller decides where the breaks are kept.
+ */
+extern size_t wrapRow(const char *s, size_t len, size_t start, size_t width, size_t *end);
+#endif